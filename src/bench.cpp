@@ -0,0 +1,473 @@
+// Microbenchmarks for the hot kernels, built as its own executable next to main.cpp
+#include "helper.h"
+#include "bench_results.h"
+#include "starfield.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BENCH_SSE 1
+#endif
+
+using namespace std;
+
+// Benchmark settings
+const int warmup_runs = 3;
+const int repetitions = 25;
+// Each repetition runs the kernel enough times to take at least this long
+const double min_sample_seconds = 0.002;
+// Samples further than this many scaled MADs from the median are dropped
+const double outlier_mads = 3.0;
+
+const size_t star_counts[] = { 1000, 2500, 10000, 50000 };
+
+// Gives the benchmarks access to the near star arrays
+struct StarfieldAccess {
+    static size_t near_count(Starfield& f) {
+        return f.near_stars.size();
+    }
+    // Every group's pending motion applied to its stars, like update_group does before the bound check
+    static void integrate_all(Starfield& f) {
+        f.update_scratch.resize(f.near_stars.size());
+        f.update_drift_scratch.resize(f.near_stars.size());
+        for (const auto& group : f.groups)
+            f.integrate_near(group.motion, group.begin, group.end, &f.update_scratch[group.begin], &f.update_drift_scratch[group.begin]);
+    }
+    static void gather_near(Starfield& f) {
+        f.gather_near_positions();
+    }
+    static const Position& first_gathered(Starfield& f) {
+        return f.now_scratch[0];
+    }
+};
+
+// Stops the compiler from throwing away results
+template <class T>
+void keep(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+#endif
+}
+
+vector<BenchResult> results;
+string filter;
+
+double median_of(vector<double> v) {
+    sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// Times fn, items is how many elements one call processes so we can report per item cost
+void bench(const string& kernel, const string& variant, size_t size, size_t items, const function<void()>& fn) {
+    string name = kernel + "/" + variant;
+    if (!filter.empty() && name.find(filter) == string::npos)
+        return;
+
+    using clock = chrono::steady_clock;
+    for (int i = 0; i < warmup_runs; i++)
+        fn();
+
+    // Find how many calls make one sample long enough to time reliably
+    size_t iters = 1;
+    while (true) {
+        clock::time_point t0 = clock::now();
+        for (size_t i = 0; i < iters; i++)
+            fn();
+        double s = chrono::duration<double>(clock::now() - t0).count();
+        if (s >= min_sample_seconds || iters >= (1u << 24))
+            break;
+        iters *= 2;
+    }
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; r++) {
+        clock::time_point t0 = clock::now();
+        for (size_t i = 0; i < iters; i++)
+            fn();
+        samples.push_back(chrono::duration<double, nano>(clock::now() - t0).count() / iters);
+    }
+
+    double med = median_of(samples);
+    vector<double> deviations;
+    for (double s : samples)
+        deviations.push_back(fabs(s - med));
+    // 1.4826 turns the MAD into a standard deviation estimate for normal data
+    double mad = median_of(deviations) * 1.4826;
+
+    vector<double> kept;
+    for (double s : samples) {
+        if (mad == 0 || fabs(s - med) <= outlier_mads * mad)
+            kept.push_back(s);
+    }
+    double mean = 0, var = 0;
+    for (double s : kept)
+        mean += s;
+    mean /= kept.size();
+    for (double s : kept)
+        var += (s - mean) * (s - mean);
+
+    BenchResult r;
+    r.kernel = kernel;
+    r.variant = variant;
+    r.size = size;
+    r.items = items;
+    r.median_ns = median_of(kept);
+    r.mean_ns = mean;
+    r.min_ns = *min_element(kept.begin(), kept.end());
+    r.stddev_ns = kept.size() > 1 ? sqrt(var / (kept.size() - 1)) : 0;
+    r.kept = int(kept.size());
+    r.rejected = int(samples.size() - kept.size());
+    r.samples = kept;
+    results.push_back(r);
+
+    cout << left << setw(26) << kernel << setw(14) << variant << right << setw(8) << size
+        << fixed << setprecision(1) << setw(14) << r.median_ns << setw(10) << r.median_ns / items
+        << setw(12) << r.min_ns << setw(10) << r.stddev_ns << setw(6) << r.rejected << endl;
+}
+
+// Alternative layouts of the star update so we can compare them with the Star objects.
+// They move first and then bound check, with the respawn rules of the batched respawn
+
+float respawn_xy(float p) {
+    return p <= -2.5f ? generate_xy_far() : -generate_xy_far();
+}
+
+float respawn_z(float p) {
+    return p < -5.f ? generate_z_far() : -generate_z_far();
+}
+
+struct AosStars {
+    vector<Position> p;
+
+    void tick(float dt, Position v) {
+        for (Position& s : p) {
+            s.x += v.x * dt; s.y += v.y * dt; s.z += v.z * dt;
+            if (s.x <= -2.5f || s.x >= 2.5f) s.x = respawn_xy(s.x);
+            if (s.y <= -2.5f || s.y >= 2.5f) s.y = respawn_xy(s.y);
+            if (s.z < -5.f || s.z > 5.f) s.z = respawn_z(s.z);
+        }
+    }
+
+    void rotate_y(float deg) {
+        float c = cos(to_rad(deg)), sn = sin(to_rad(deg));
+        for (Position& s : p) {
+            float x = s.x * c + s.z * sn;
+            s.z = -s.x * sn + s.z * c;
+            s.x = x;
+        }
+    }
+};
+
+struct SoaStars {
+    vector<float> x, y, z;
+    // Own velocity of every star, for the drift kernels
+    vector<float> vx, vy, vz;
+
+    void tick_scalar(float dt, Position v) {
+        size_t n = x.size();
+        for (size_t i = 0; i < n; i++) {
+            x[i] += v.x * dt; y[i] += v.y * dt; z[i] += v.z * dt;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (x[i] <= -2.5f || x[i] >= 2.5f) x[i] = respawn_xy(x[i]);
+            if (y[i] <= -2.5f || y[i] >= 2.5f) y[i] = respawn_xy(y[i]);
+            if (z[i] < -5.f || z[i] > 5.f) z[i] = respawn_z(z[i]);
+        }
+    }
+
+    // Field velocity plus each star's own
+    void tick_drift_scalar(float dt, Position v) {
+        size_t n = x.size();
+        for (size_t i = 0; i < n; i++) {
+            x[i] += (v.x + vx[i]) * dt; y[i] += (v.y + vy[i]) * dt; z[i] += (v.z + vz[i]) * dt;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (x[i] <= -2.5f || x[i] >= 2.5f) x[i] = respawn_xy(x[i]);
+            if (y[i] <= -2.5f || y[i] >= 2.5f) y[i] = respawn_xy(y[i]);
+            if (z[i] < -5.f || z[i] > 5.f) z[i] = respawn_z(z[i]);
+        }
+    }
+
+    void rotate_y_scalar(float deg) {
+        float c = cos(to_rad(deg)), sn = sin(to_rad(deg));
+        size_t n = x.size();
+        for (size_t i = 0; i < n; i++) {
+            float nx = x[i] * c + z[i] * sn;
+            z[i] = -x[i] * sn + z[i] * c;
+            x[i] = nx;
+        }
+    }
+
+#ifdef BENCH_SSE
+    // Four stars at a time, lanes that left the box are fixed up one by one
+    void tick_sse(float dt, Position v) {
+        size_t n = x.size() / 4 * 4;
+        __m128 vx = _mm_set1_ps(v.x * dt), vy = _mm_set1_ps(v.y * dt), vz = _mm_set1_ps(v.z * dt);
+        __m128 xy_lo = _mm_set1_ps(-2.5f), xy_hi = _mm_set1_ps(2.5f);
+        __m128 z_lo = _mm_set1_ps(-5.f), z_hi = _mm_set1_ps(5.f);
+        for (size_t i = 0; i < n; i += 4) {
+            __m128 px = _mm_add_ps(_mm_loadu_ps(&x[i]), vx);
+            __m128 py = _mm_add_ps(_mm_loadu_ps(&y[i]), vy);
+            __m128 pz = _mm_add_ps(_mm_loadu_ps(&z[i]), vz);
+            _mm_storeu_ps(&x[i], px);
+            _mm_storeu_ps(&y[i], py);
+            _mm_storeu_ps(&z[i], pz);
+            __m128 out = _mm_or_ps(_mm_or_ps(_mm_cmple_ps(px, xy_lo), _mm_cmpge_ps(px, xy_hi)),
+                _mm_or_ps(_mm_cmple_ps(py, xy_lo), _mm_cmpge_ps(py, xy_hi)));
+            out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(pz, z_lo), _mm_cmpgt_ps(pz, z_hi)));
+            int mask = _mm_movemask_ps(out);
+            while (mask) {
+                int lane = 0;
+                while (!(mask & (1 << lane)))
+                    lane++;
+                mask &= ~(1 << lane);
+                size_t j = i + lane;
+                if (x[j] <= -2.5f || x[j] >= 2.5f) x[j] = respawn_xy(x[j]);
+                if (y[j] <= -2.5f || y[j] >= 2.5f) y[j] = respawn_xy(y[j]);
+                if (z[j] < -5.f || z[j] > 5.f) z[j] = respawn_z(z[j]);
+            }
+        }
+        for (size_t j = n; j < x.size(); j++) {
+            x[j] += v.x * dt; y[j] += v.y * dt; z[j] += v.z * dt;
+            if (x[j] <= -2.5f || x[j] >= 2.5f) x[j] = respawn_xy(x[j]);
+            if (y[j] <= -2.5f || y[j] >= 2.5f) y[j] = respawn_xy(y[j]);
+            if (z[j] < -5.f || z[j] > 5.f) z[j] = respawn_z(z[j]);
+        }
+    }
+
+    void tick_drift_sse(float dt, Position v) {
+        size_t n = x.size() / 4 * 4;
+        __m128 vdt = _mm_set1_ps(dt);
+        __m128 fx = _mm_set1_ps(v.x), fy = _mm_set1_ps(v.y), fz = _mm_set1_ps(v.z);
+        __m128 xy_lo = _mm_set1_ps(-2.5f), xy_hi = _mm_set1_ps(2.5f);
+        __m128 z_lo = _mm_set1_ps(-5.f), z_hi = _mm_set1_ps(5.f);
+        for (size_t i = 0; i < n; i += 4) {
+            __m128 px = _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_mul_ps(_mm_add_ps(fx, _mm_loadu_ps(&vx[i])), vdt));
+            __m128 py = _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(_mm_add_ps(fy, _mm_loadu_ps(&vy[i])), vdt));
+            __m128 pz = _mm_add_ps(_mm_loadu_ps(&z[i]), _mm_mul_ps(_mm_add_ps(fz, _mm_loadu_ps(&vz[i])), vdt));
+            _mm_storeu_ps(&x[i], px);
+            _mm_storeu_ps(&y[i], py);
+            _mm_storeu_ps(&z[i], pz);
+            __m128 out = _mm_or_ps(_mm_or_ps(_mm_cmple_ps(px, xy_lo), _mm_cmpge_ps(px, xy_hi)),
+                _mm_or_ps(_mm_cmple_ps(py, xy_lo), _mm_cmpge_ps(py, xy_hi)));
+            out = _mm_or_ps(out, _mm_or_ps(_mm_cmplt_ps(pz, z_lo), _mm_cmpgt_ps(pz, z_hi)));
+            int mask = _mm_movemask_ps(out);
+            while (mask) {
+                int lane = 0;
+                while (!(mask & (1 << lane)))
+                    lane++;
+                mask &= ~(1 << lane);
+                size_t j = i + lane;
+                if (x[j] <= -2.5f || x[j] >= 2.5f) x[j] = respawn_xy(x[j]);
+                if (y[j] <= -2.5f || y[j] >= 2.5f) y[j] = respawn_xy(y[j]);
+                if (z[j] < -5.f || z[j] > 5.f) z[j] = respawn_z(z[j]);
+            }
+        }
+        for (size_t j = n; j < x.size(); j++) {
+            x[j] += (v.x + vx[j]) * dt; y[j] += (v.y + vy[j]) * dt; z[j] += (v.z + vz[j]) * dt;
+            if (x[j] <= -2.5f || x[j] >= 2.5f) x[j] = respawn_xy(x[j]);
+            if (y[j] <= -2.5f || y[j] >= 2.5f) y[j] = respawn_xy(y[j]);
+            if (z[j] < -5.f || z[j] > 5.f) z[j] = respawn_z(z[j]);
+        }
+    }
+
+    void rotate_y_sse(float deg) {
+        float c = cos(to_rad(deg)), sn = sin(to_rad(deg));
+        size_t n = x.size() / 4 * 4;
+        __m128 vc = _mm_set1_ps(c), vs = _mm_set1_ps(sn);
+        for (size_t i = 0; i < n; i += 4) {
+            __m128 px = _mm_loadu_ps(&x[i]);
+            __m128 pz = _mm_loadu_ps(&z[i]);
+            _mm_storeu_ps(&x[i], _mm_add_ps(_mm_mul_ps(px, vc), _mm_mul_ps(pz, vs)));
+            _mm_storeu_ps(&z[i], _mm_sub_ps(_mm_mul_ps(pz, vc), _mm_mul_ps(px, vs)));
+        }
+        for (size_t i = n; i < x.size(); i++) {
+            float nx = x[i] * c + z[i] * sn;
+            z[i] = -x[i] * sn + z[i] * c;
+            x[i] = nx;
+        }
+    }
+#endif
+};
+
+void bench_generators() {
+    const size_t calls = 10000;
+    float sum = 0;
+    bench("generate_xy", "scalar", calls, calls, [&] { for (size_t i = 0; i < calls; i++) sum += generate_xy(); keep(sum); });
+    bench("generate_xy_far", "scalar", calls, calls, [&] { for (size_t i = 0; i < calls; i++) sum += generate_xy_far(); keep(sum); });
+    bench("generate_z", "scalar", calls, calls, [&] { for (size_t i = 0; i < calls; i++) sum += generate_z(); keep(sum); });
+    bench("generate_z_far", "scalar", calls, calls, [&] { for (size_t i = 0; i < calls; i++) sum += generate_z_far(); keep(sum); });
+    bench("generate_color", "scalar", calls, calls, [&] { for (size_t i = 0; i < calls; i++) sum += generate_color(); keep(sum); });
+}
+
+void bench_stars(size_t n) {
+    // Moving field so bound checks and respawns actually happen
+    Starfield field{ int(n), { 0.3f, -0.2f, -1.f, 1 } };
+    // The wrap mode and the batched respawn, on copies of the centers
+    vector<Position> centers;
+    vector<uint32_t> ids;
+    for (uint32_t i = 0; i < n; i++) {
+        centers.push_back({ generate_xy() * 1.1f, generate_xy() * 1.1f, generate_z() * 1.1f, 1 });
+        ids.push_back(i);
+    }
+    vector<Position> respawned = centers;
+    bench("wrap_into_box", "star", n, n, [&] { wrap_into_box(centers.data(), ids.data(), n, 1); keep(centers[0]); });
+    // The batched respawn, after the first run only the scan is left
+    vector<uint32_t> out_list(n + 4);
+    bench("collect_out_of_box + respawn_listed", "star", n, n, [&] {
+        size_t count = collect_out_of_box(respawned.data(), n, out_list.data());
+        respawn_listed(respawned.data(), out_list.data(), count, ids.data(), 1);
+        keep(respawned[0]);
+    });
+    bench("Starfield::rebake_far", "star", n, n, [&] { field.rebake_far(); keep(field.get_far_count()); });
+    // The shipped near star update, with every star's own drift and with all of them at 0
+    float drift = max_drift;
+    max_drift = 0;
+    Starfield still{ int(n), { 0.3f, -0.2f, -1.f, 1 } };
+    max_drift = drift;
+    field.step(frame_duration);
+    still.step(frame_duration);
+    size_t near = StarfieldAccess::near_count(field), still_near = StarfieldAccess::near_count(still);
+    bench("Starfield::integrate_near", "drift", n, near, [&] { StarfieldAccess::integrate_all(field); });
+    bench("Starfield::integrate_near", "no_drift", n, still_near, [&] { StarfieldAccess::integrate_all(still); });
+    bench("Starfield::gather_near_positions", "drift", n, near, [&] {
+        StarfieldAccess::gather_near(field);
+        keep(StarfieldAccess::first_gathered(field));
+    });
+    bench("Starfield::gather_near_positions", "no_drift", n, still_near, [&] {
+        StarfieldAccess::gather_near(still);
+        keep(StarfieldAccess::first_gathered(still));
+    });
+    frame_counters = FrameCounters{};
+
+    // Frustum cull and packing of the instanced path, one chunk
+    StarSnapshot snap;
+    FrameBuild build;
+    field.write_snapshot(snap);
+    field.prepare_build(build, 1);
+    Frustum frustum = Frustum::from_projection(f, aspect, Znear, Zfar, cull_guard);
+    bench("Starfield::write_snapshot", "star", n, n, [&] { field.write_snapshot(snap); keep(snap.clusters.size()); });
+    bench("Starfield::cull_chunk", "star", n, n, [&] { field.cull_chunk(snap, 0.5f, frustum, build, 0, 1); keep(build.chunk_counts[0].points); });
+    bench("Starfield::build_chunk", "star", n, n, [&] { field.build_chunk(snap, build, 0, 1); keep(build.visible_count); });
+    // The CPU side of a whole frame as the flythrough runs it: step, snapshot, cull and pack, far re-bakes included
+    Starfield moving{ int(n), { 0.3f, -0.2f, -1.f, 1 } };
+    StarSnapshot frame_snap;
+    FrameBuild frame_build;
+    moving.prepare_build(frame_build, 1);
+    bench("Starfield::frame", "star", n, n, [&] {
+        moving.step(frame_duration);
+        moving.write_snapshot(frame_snap);
+        moving.cull_chunk(frame_snap, 1, frustum, frame_build, 0, 1);
+        moving.build_chunk(frame_snap, frame_build, 0, 1);
+        keep(frame_build.visible_count);
+    });
+    frame_counters = FrameCounters{};
+
+    // Same work as the star update in different layouts, outside the Starfield
+    AosStars aos;
+    SoaStars soa;
+    for (size_t i = 0; i < n; i++) {
+        Position p{ generate_xy(), generate_xy(), generate_z(), 1 };
+        aos.p.push_back(p);
+        soa.x.push_back(p.x);
+        soa.y.push_back(p.y);
+        soa.z.push_back(p.z);
+        Position drift = generate_drift();
+        soa.vx.push_back(drift.x);
+        soa.vy.push_back(drift.y);
+        soa.vz.push_back(drift.z);
+    }
+    Position v{ 0.3f, -0.2f, -1.f, 1 };
+    bench("update", "aos_scalar", n, n, [&] { aos.tick(float(frame_duration), v); keep(aos.p[0]); });
+    bench("update", "soa_scalar", n, n, [&] { soa.tick_scalar(float(frame_duration), v); keep(soa.x[0]); });
+    bench("update", "soa_scalar_drift", n, n, [&] { soa.tick_drift_scalar(float(frame_duration), v); keep(soa.x[0]); });
+    bench("rotate_y", "aos_scalar", n, n, [&] { aos.rotate_y(0.1f); keep(aos.p[0]); });
+    bench("rotate_y", "soa_scalar", n, n, [&] { soa.rotate_y_scalar(0.1f); keep(soa.x[0]); });
+#ifdef BENCH_SSE
+    bench("update", "soa_sse", n, n, [&] { soa.tick_sse(float(frame_duration), v); keep(soa.x[0]); });
+    bench("update", "soa_sse_drift", n, n, [&] { soa.tick_drift_sse(float(frame_duration), v); keep(soa.x[0]); });
+    bench("rotate_y", "soa_sse", n, n, [&] { soa.rotate_y_sse(0.1f); keep(soa.x[0]); });
+#endif
+}
+
+int main(int argc, char** argv) {
+    string json_path, compare_base, compare_new;
+    // Slowdown that counts as a regression and the significance level it has to reach
+    double threshold = 0.05, alpha = 0.01;
+    bool headless = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if (arg == "--compare" && i + 2 < argc) {
+            compare_base = argv[++i];
+            compare_new = argv[++i];
+        }
+        else if (arg == "--threshold" && i + 1 < argc)
+            threshold = stod(argv[++i]) / 100;
+        else if (arg == "--alpha" && i + 1 < argc)
+            alpha = stod(argv[++i]);
+        else if (arg == "--headless")
+            headless = true;
+    }
+
+    // Compare mode doesn't run anything
+    if (!compare_base.empty()) {
+        try {
+            int regressions = compare_runs(read_json(compare_base), read_json(compare_new), threshold, alpha, cout);
+            cout << regressions << " regression(s) over " << threshold * 100 << "%" << endl;
+            return regressions ? 1 : 0;
+        }
+        catch (const std::exception& e) {
+            cout << e.what() << endl;
+            return 2;
+        }
+    }
+
+    // The kernels are all CPU side, headless runs them without a window or GL context
+    GLFWwindow* window = nullptr;
+    if (headless) {
+        gl_enabled = false;
+        WIDTH = 1280;
+        HEIGHT = 720;
+        aspect = float(WIDTH) / HEIGHT;
+    }
+    else {
+        try {
+            window = window_init_hidden(1280, 720);
+            load_OpenGL();
+        }
+        catch (const std::exception& e) {
+            cout << e.what() << ", run with --headless to bench without a display" << endl;
+            return 2;
+        }
+        create_and_use_shaders(instanced_vs, fs);
+    }
+
+    cout << left << setw(26) << "kernel" << setw(14) << "variant" << right << setw(8) << "size"
+        << setw(14) << "median ns" << setw(10) << "ns/item" << setw(12) << "min ns"
+        << setw(10) << "stddev" << setw(6) << "out" << endl;
+
+    bench_generators();
+    for (size_t n : star_counts)
+        bench_stars(n);
+
+    if (window)
+        terminate(window);
+
+    if (!json_path.empty()) {
+        BenchRun run{ collect_meta(), results };
+        if (!write_json(json_path, run)) {
+            cout << "Couldn't write " << json_path << endl;
+            return 2;
+        }
+    }
+}
@@ -0,0 +1,409 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#else
+#include <unistd.h>
+#endif
+
+// Storing benchmark runs as JSON and comparing two of them
+
+struct BenchResult {
+    std::string kernel;
+    std::string variant;
+    size_t size;
+    size_t items;
+    double median_ns, mean_ns, min_ns, stddev_ns;
+    int kept, rejected;
+    // Samples left after outlier rejection, needed for the significance test
+    std::vector<double> samples;
+
+    std::string key() const {
+        return kernel + "/" + variant + "/" + std::to_string(size);
+    }
+};
+
+struct BenchRun {
+    std::map<std::string, std::string> meta;
+    std::vector<BenchResult> results;
+};
+
+// Environment the numbers were taken in
+
+std::string run_command(const char* cmd) {
+    std::string out;
+    FILE* p = popen(cmd, "r");
+    if (!p)
+        return out;
+    char buf[256];
+    while (fgets(buf, sizeof(buf), p))
+        out += buf;
+    pclose(p);
+    while (!out.empty() && std::isspace((unsigned char)out.back()))
+        out.pop_back();
+    return out;
+}
+
+std::string host_name() {
+#ifdef _WIN32
+    const char* name = std::getenv("COMPUTERNAME");
+    return name ? name : "unknown";
+#else
+    char buf[256] = {};
+    return gethostname(buf, sizeof(buf) - 1) == 0 ? buf : "unknown";
+#endif
+}
+
+std::string cpu_model() {
+    unsigned int regs[12] = {};
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004) {
+        for (unsigned int i = 0; i < 3; i++)
+            __get_cpuid(0x80000002 + i, &regs[i * 4], &regs[i * 4 + 1], &regs[i * 4 + 2], &regs[i * 4 + 3]);
+    }
+#elif defined(_MSC_VER)
+    for (int i = 0; i < 3; i++)
+        __cpuid((int*)&regs[i * 4], 0x80000002 + i);
+#endif
+    std::string model(reinterpret_cast<const char*>(regs), sizeof(regs));
+    model = model.c_str();
+    if (model.empty()) {
+        std::ifstream info("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(info, line)) {
+            if (line.rfind("model name", 0) == 0 || line.rfind("Model", 0) == 0) {
+                model = line.substr(line.find(':') + 1);
+                break;
+            }
+        }
+    }
+    size_t start = model.find_first_not_of(' ');
+    return start == std::string::npos ? "unknown" : model.substr(start);
+}
+
+std::string compiler_name() {
+#if defined(__clang__)
+    return std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    return std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+// Pass -DBENCH_GIT_REV=... when building outside of the checkout
+std::string git_revision() {
+#ifdef BENCH_GIT_REV
+    return BENCH_GIT_REV;
+#else
+    std::string rev = run_command("git rev-parse --short HEAD 2>&1");
+    if (rev.empty() || rev.find(' ') != std::string::npos)
+        return "unknown";
+    if (!run_command("git status --porcelain --untracked-files=no 2>&1").empty())
+        rev += "-dirty";
+    return rev;
+#endif
+}
+
+std::map<std::string, std::string> collect_meta() {
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return {
+        { "host", host_name() },
+        { "cpu", cpu_model() },
+        { "compiler", compiler_name() },
+        { "git_revision", git_revision() },
+        { "timestamp", stamp }
+    };
+}
+
+// Writing
+
+std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+bool write_json(const std::string& path, const BenchRun& run) {
+    std::ofstream out(path);
+    if (!out)
+        return false;
+    out << std::setprecision(10);
+    out << "{\n  \"meta\": {";
+    bool first = true;
+    for (const auto& m : run.meta) {
+        out << (first ? "\n" : ",\n") << "    \"" << json_escape(m.first) << "\": \"" << json_escape(m.second) << "\"";
+        first = false;
+    }
+    out << "\n  },\n  \"results\": [";
+    for (size_t i = 0; i < run.results.size(); i++) {
+        const BenchResult& r = run.results[i];
+        out << (i ? ",\n" : "\n") << "    { \"kernel\": \"" << json_escape(r.kernel)
+            << "\", \"variant\": \"" << json_escape(r.variant) << "\", \"size\": " << r.size
+            << ", \"items\": " << r.items << ", \"median_ns\": " << r.median_ns
+            << ", \"mean_ns\": " << r.mean_ns << ", \"min_ns\": " << r.min_ns
+            << ", \"stddev_ns\": " << r.stddev_ns << ", \"kept\": " << r.kept
+            << ", \"rejected\": " << r.rejected << ", \"samples\": [";
+        for (size_t s = 0; s < r.samples.size(); s++)
+            out << (s ? ", " : "") << r.samples[s];
+        out << "] }";
+    }
+    out << "\n  ]\n}\n";
+    return true;
+}
+
+// Reading, only as much JSON as write_json produces
+
+class JsonReader {
+    const std::string& text;
+    size_t pos = 0;
+
+    void skip() {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos]))
+            pos++;
+    }
+
+    void expect(char c) {
+        skip();
+        if (pos >= text.size() || text[pos] != c)
+            throw std::runtime_error(std::string("bad benchmark json, expected ") + c + " at " + std::to_string(pos));
+        pos++;
+    }
+
+    bool peek(char c) {
+        skip();
+        return pos < text.size() && text[pos] == c;
+    }
+
+    std::string string_value() {
+        expect('"');
+        std::string out;
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c == '\\' && pos < text.size()) {
+                c = text[pos++];
+                if (c == 'u' && pos + 4 <= text.size()) {
+                    c = char(std::strtol(text.substr(pos, 4).c_str(), nullptr, 16));
+                    pos += 4;
+                }
+            }
+            out += c;
+        }
+        expect('"');
+        return out;
+    }
+
+    double number() {
+        skip();
+        const char* start = text.c_str() + pos;
+        char* end;
+        double v = std::strtod(start, &end);
+        if (end == start)
+            throw std::runtime_error("bad benchmark json, expected a number at " + std::to_string(pos));
+        pos += end - start;
+        return v;
+    }
+
+    std::vector<double> number_array() {
+        std::vector<double> out;
+        expect('[');
+        while (!peek(']')) {
+            out.push_back(number());
+            if (peek(','))
+                pos++;
+        }
+        expect(']');
+        return out;
+    }
+
+    BenchResult result() {
+        BenchResult r{};
+        expect('{');
+        while (!peek('}')) {
+            std::string k = string_value();
+            expect(':');
+            if (k == "kernel") r.kernel = string_value();
+            else if (k == "variant") r.variant = string_value();
+            else if (k == "samples") r.samples = number_array();
+            else {
+                double v = number();
+                if (k == "size") r.size = size_t(v);
+                else if (k == "items") r.items = size_t(v);
+                else if (k == "median_ns") r.median_ns = v;
+                else if (k == "mean_ns") r.mean_ns = v;
+                else if (k == "min_ns") r.min_ns = v;
+                else if (k == "stddev_ns") r.stddev_ns = v;
+                else if (k == "kept") r.kept = int(v);
+                else if (k == "rejected") r.rejected = int(v);
+            }
+            if (peek(','))
+                pos++;
+        }
+        expect('}');
+        return r;
+    }
+
+public:
+    JsonReader(const std::string& text) : text{ text } {
+    }
+
+    BenchRun run() {
+        BenchRun run;
+        expect('{');
+        while (!peek('}')) {
+            std::string k = string_value();
+            expect(':');
+            if (k == "meta") {
+                expect('{');
+                while (!peek('}')) {
+                    std::string mk = string_value();
+                    expect(':');
+                    run.meta[mk] = string_value();
+                    if (peek(','))
+                        pos++;
+                }
+                expect('}');
+            }
+            else if (k == "results") {
+                expect('[');
+                while (!peek(']')) {
+                    run.results.push_back(result());
+                    if (peek(','))
+                        pos++;
+                }
+                expect(']');
+            }
+            if (peek(','))
+                pos++;
+        }
+        expect('}');
+        return run;
+    }
+};
+
+BenchRun read_json(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Couldn't open " + path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    return JsonReader{ text }.run();
+}
+
+// Comparing
+
+// Two sided p value of the Mann-Whitney U test with the normal approximation and tie correction.
+// Makes no assumption about the shape of the timing distribution
+double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b) {
+    size_t n1 = a.size(), n2 = b.size();
+    if (n1 < 2 || n2 < 2)
+        return 1;
+
+    std::vector<std::pair<double, int>> all;
+    for (double v : a) all.push_back({ v, 0 });
+    for (double v : b) all.push_back({ v, 1 });
+    std::sort(all.begin(), all.end());
+
+    double rank_sum_a = 0, tie_term = 0;
+    size_t n = all.size();
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        while (j < n && all[j].first == all[i].first)
+            j++;
+        double rank = (i + 1 + j) / 2.0;
+        double t = double(j - i);
+        tie_term += t * t * t - t;
+        for (size_t k = i; k < j; k++) {
+            if (all[k].second == 0)
+                rank_sum_a += rank;
+        }
+        i = j;
+    }
+
+    double u = rank_sum_a - n1 * (n1 + 1) / 2.0;
+    double mean = n1 * n2 / 2.0;
+    double var = n1 * n2 / 12.0 * ((n + 1) - tie_term / (double(n) * (n - 1)));
+    if (var <= 0)
+        return 1;
+    double z = (std::fabs(u - mean) - 0.5) / std::sqrt(var);
+    return std::erfc(std::max(z, 0.0) / std::sqrt(2.0));
+}
+
+// Prints every kernel found in both runs, returns how many got significantly slower by more than threshold
+int compare_runs(const BenchRun& base, const BenchRun& next, double threshold, double alpha, std::ostream& os) {
+    std::map<std::string, const BenchResult*> base_results;
+    for (const BenchResult& r : base.results)
+        base_results[r.key()] = &r;
+
+    auto meta = [](const BenchRun& r, const char* k) {
+        auto it = r.meta.find(k);
+        return it == r.meta.end() ? std::string("?") : it->second;
+    };
+    os << "base: " << meta(base, "git_revision") << " on " << meta(base, "cpu") << "\n"
+        << "new:  " << meta(next, "git_revision") << " on " << meta(next, "cpu") << "\n";
+    if (meta(base, "cpu") != meta(next, "cpu"))
+        os << "warning: runs come from different CPUs\n";
+
+    os << std::left << std::setw(46) << "kernel" << std::right << std::setw(12) << "base ns"
+        << std::setw(12) << "new ns" << std::setw(9) << "change" << std::setw(9) << "p" << "\n";
+
+    int regressions = 0;
+    for (const BenchResult& r : next.results) {
+        auto it = base_results.find(r.key());
+        if (it == base_results.end())
+            continue;
+        const BenchResult& b = *it->second;
+        double change = b.median_ns > 0 ? r.median_ns / b.median_ns - 1 : 0;
+        double p = mann_whitney_p(b.samples, r.samples);
+        const char* verdict = "";
+        if (p < alpha && change > threshold) {
+            verdict = "  REGRESSION";
+            regressions++;
+        }
+        else if (p < alpha && change < -threshold) {
+            verdict = "  faster";
+        }
+        os << std::left << std::setw(46) << r.key() << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << b.median_ns << std::setw(12) << r.median_ns
+            << std::setw(8) << change * 100 << "%" << std::setprecision(4) << std::setw(9) << p
+            << verdict << "\n";
+    }
+    return regressions;
+}
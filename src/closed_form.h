@@ -0,0 +1,152 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstddef>
+#include <vector>
+#include "helper.h"
+#include "star_renderer.h"
+#include "starfield.h"
+#include "stats.h"
+
+// Closed form vertex shader: every star is where it started plus the field's displacement, wrapped into the box.
+// Crossing a side of the box shifts the star along the other two axes by a hash of its index and how many boxes
+// it is away, which stands in for the random respawn of the CPU path
+const std::string closed_vs = R"glsl(
+#version 330 core
+
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec4 origin_radius;
+layout(location = 2) in vec4 color;
+out vec4 c_in;
+
+uniform float zNear;
+uniform float zFar;
+uniform float frustumScale;
+uniform float aspect;
+uniform mat3 view;
+uniform vec3 displacement;
+uniform ivec3 boxOffset;
+uniform vec3 box;
+
+uint hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Shift along one axis for a star that has wrapped across the other two, none before it ever wrapped
+float jitter(uint star, int a, int b, uint salt) {
+    uint h = hash(star ^ hash(uint(a) ^ hash(uint(b) ^ salt)));
+    return (a == 0 && b == 0) ? 0.0 : float(h >> 8) / 16777216.0;
+}
+
+void main()
+{
+   vec3 p = origin_radius.xyz + displacement;
+   vec3 cell = floor(p / box + 0.5);
+   ivec3 k = ivec3(cell) + boxOffset;
+   p -= cell * box;
+
+   uint star = uint(gl_InstanceID);
+   p += box * vec3(jitter(star, k.y, k.z, 1u), jitter(star, k.x, k.z, 2u), jitter(star, k.x, k.y, 3u));
+   p -= floor(p / box + 0.5) * box;
+
+   vec3 cameraPos3 = view * p;
+   cameraPos3.xy += corner * origin_radius.w;
+   vec4 cameraPos = vec4(cameraPos3, 1.0);
+   vec4 clipPos;
+
+   clipPos.xy = cameraPos.xy * frustumScale;
+   clipPos.x /= aspect;
+   clipPos.z = cameraPos.z * zFar / (zFar - zNear);
+   clipPos.z -= zNear * zFar / (zFar - zNear);
+   clipPos.w = cameraPos.z;
+
+   gl_Position = clipPos;
+   c_in = color;
+}
+)glsl";
+
+// Draws the whole field in closed form: the stars are uploaded once, every frame only sets a few uniforms
+class ClosedFormRenderer {
+    static const int points = 8;
+    unsigned int prog = 0, va = 0, mesh_vb = 0, eb = 0, instance_vb = 0;
+    int view_unif = -1, frustum_scale_unif = -1, displacement_unif = -1, box_offset_unif = -1;
+    size_t count;
+
+public:
+    // Takes the stars where they are now, needs the program that should be current afterwards
+    ClosedFormRenderer(Starfield& field, unsigned int restore_prog) {
+        std::vector<StarInstance> instances;
+        field.write_all_instances(instances);
+        count = instances.size();
+
+        float corners[points * 2];
+        unsigned int indices[(points - 2) * 3];
+        fill_circle_mesh<points>(corners, indices);
+
+        if (gl_enabled) {
+            prog = create_and_use_shaders(closed_vs, fs);
+            glUniform1f(glGetUniformLocation(prog, "zNear"), Znear);
+            glUniform1f(glGetUniformLocation(prog, "zFar"), Zfar);
+            glUniform1f(glGetUniformLocation(prog, "aspect"), aspect);
+            glUniform3f(glGetUniformLocation(prog, "box"), box_size[0], box_size[1], box_size[2]);
+            view_unif = glGetUniformLocation(prog, "view");
+            frustum_scale_unif = glGetUniformLocation(prog, "frustumScale");
+            displacement_unif = glGetUniformLocation(prog, "displacement");
+            box_offset_unif = glGetUniformLocation(prog, "boxOffset");
+            glGenVertexArrays(1, &va);
+            glGenBuffers(1, &mesh_vb);
+            glGenBuffers(1, &eb);
+            glGenBuffers(1, &instance_vb);
+        }
+        counted_bind_vertex_array(va);
+        counted_bind_buffer(GL_ARRAY_BUFFER, mesh_vb);
+        counted_buffer_data(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        counted_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, eb);
+        counted_buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        if (gl_enabled) {
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+            glEnableVertexAttribArray(0);
+        }
+
+        counted_bind_buffer(GL_ARRAY_BUFFER, instance_vb);
+        counted_buffer_data(GL_ARRAY_BUFFER, count * sizeof(StarInstance), instances.data(), GL_STATIC_DRAW);
+        if (gl_enabled) {
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), 0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribDivisor(1, 1);
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), (void*)offsetof(StarInstance, r));
+            glEnableVertexAttribArray(2);
+            glVertexAttribDivisor(2, 1);
+        }
+        counted_bind_buffer(GL_ARRAY_BUFFER, 0);
+        counted_bind_vertex_array(0);
+        if (gl_enabled)
+            glUseProgram(restore_prog);
+    }
+
+    // alpha of the way from the step before state to state, then turned by the view. Leaves restore_prog current
+    void draw(const ClosedFormState& state, float alpha, float yaw, float pitch, float frustum_scale,
+        unsigned int restore_prog) {
+        frame_counters.visible_stars += count;
+        float v[9], axes[9], m[9];
+        view_rotation(yaw, pitch, v);
+        state.turn.write_axes(axes);
+        mat3_multiply(v, axes, m);
+        ClosedFormState now = state.at(alpha);
+        counted_use_program(prog);
+        if (gl_enabled) {
+            glUniformMatrix3fv(view_unif, 1, GL_FALSE, m);
+            glUniform1f(frustum_scale_unif, frustum_scale);
+            glUniform3f(displacement_unif, now.displacement[0], now.displacement[1], now.displacement[2]);
+            glUniform3i(box_offset_unif, state.cells[0], state.cells[1], state.cells[2]);
+        }
+        counted_bind_vertex_array(va);
+        counted_draw_elements_instanced(GL_TRIANGLES, (points - 2) * 3, GL_UNSIGNED_INT, 0, GLsizei(count));
+        counted_bind_vertex_array(0);
+        counted_use_program(restore_prog);
+    }
+};
@@ -0,0 +1,226 @@
+#pragma once
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "helper.h"
+#include "star_renderer.h"
+#include "starfield.h"
+#include "stats.h"
+
+// Far stars are drawn into a cubemap around the camera once per bake, then every frame is a single skybox draw
+const int far_face_size = 1024;
+
+// Skybox shaders, the cube is drawn around the camera and looked up by direction
+const std::string skybox_vs = R"glsl(
+#version 330 core
+
+layout(location = 0) in vec3 corner;
+out vec3 dir;
+
+uniform float zNear;
+uniform float zFar;
+uniform float frustumScale;
+uniform float aspect;
+uniform mat3 view;
+
+void main()
+{
+   vec4 cameraPos = vec4(view * corner, 1.0);
+   vec4 clipPos;
+
+   clipPos.xy = cameraPos.xy * frustumScale;
+   clipPos.x /= aspect;
+   clipPos.z = cameraPos.z * zFar / (zFar - zNear);
+   clipPos.z -= zNear * zFar / (zFar - zNear);
+   clipPos.w = cameraPos.z;
+
+   gl_Position = clipPos;
+   dir = corner;
+}
+)glsl";
+
+// The stars moved by offset since the bake. Taking them all to be radius away, the view ray meets
+// a star that was baked where the ray meets that sphere moved by offset
+const std::string skybox_fs = R"glsl(
+#version 330 core
+in vec3 dir;
+out vec4 color;
+
+uniform samplerCube sky;
+uniform vec3 offset;
+uniform float radius;
+
+void main(){
+    vec3 d = normalize(dir);
+    float b = dot(d, offset);
+    float t = b + sqrt(b * b - dot(offset, offset) + radius * radius);
+    color = texture(sky, d * t - offset);
+}
+)glsl";
+
+// Rows of the camera looking down each cubemap face: right, up, forward, in the order of
+// GL_TEXTURE_CUBE_MAP_POSITIVE_X and up. Matches how GL picks the texel for a direction
+const float far_face_rows[6][9] = {
+    { 0, 0, -1, 0, -1, 0, 1, 0, 0 },
+    { 0, 0, 1, 0, -1, 0, -1, 0, 0 },
+    { 1, 0, 0, 0, 0, 1, 0, 1, 0 },
+    { 1, 0, 0, 0, 0, -1, 0, -1, 0 },
+    { 1, 0, 0, 0, -1, 0, 0, 0, 1 },
+    { -1, 0, 0, 0, -1, 0, 0, 0, -1 }
+};
+
+// Background layer of the far stars: baked into a cubemap with the sprite shaders, drawn as a skybox
+class FarLayer {
+    unsigned int cubemap = 0, fbo = 0;
+    unsigned int bake_prog = 0, bake_va = 0, bake_vb = 0;
+    int bake_view_unif = -1;
+    unsigned int sky_prog = 0, sky_va = 0, sky_vb = 0, sky_eb = 0;
+    int sky_view_unif = -1, sky_frustum_scale_unif = -1, sky_offset_unif = -1;
+    size_t capacity;
+    uint64_t baked_version = 0;
+    size_t baked_count = 0;
+
+public:
+    // Needs the program that should be current afterwards since building the programs switches to them
+    FarLayer(size_t max_stars, unsigned int restore_prog) : capacity{ max_stars } {
+        if (!gl_enabled)
+            return;
+        glGenTextures(1, &cubemap);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        for (int face = 0; face < 6; face++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA8, far_face_size, far_face_size, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glGenFramebuffers(1, &fbo);
+
+        // Every face is a 90 degree square view from the camera
+        bake_prog = create_and_use_shaders(sprite_vs, sprite_fs);
+        glUniform1f(glGetUniformLocation(bake_prog, "zNear"), Znear);
+        glUniform1f(glGetUniformLocation(bake_prog, "zFar"), Zfar);
+        glUniform1f(glGetUniformLocation(bake_prog, "aspect"), 1);
+        glUniform1f(glGetUniformLocation(bake_prog, "frustumScale"), 1);
+        glUniform1f(glGetUniformLocation(bake_prog, "viewportHeight"), float(far_face_size));
+        bake_view_unif = glGetUniformLocation(bake_prog, "view");
+        glGenVertexArrays(1, &bake_va);
+        glGenBuffers(1, &bake_vb);
+        glBindVertexArray(bake_va);
+        glBindBuffer(GL_ARRAY_BUFFER, bake_vb);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(StarInstance), nullptr, GL_STREAM_DRAW);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), (void*)offsetof(StarInstance, r));
+        glEnableVertexAttribArray(1);
+
+        sky_prog = create_and_use_shaders(skybox_vs, skybox_fs);
+        glUniform1f(glGetUniformLocation(sky_prog, "zNear"), Znear);
+        glUniform1f(glGetUniformLocation(sky_prog, "zFar"), Zfar);
+        glUniform1f(glGetUniformLocation(sky_prog, "aspect"), aspect);
+        glUniform1i(glGetUniformLocation(sky_prog, "sky"), 0);
+        glUniform1f(glGetUniformLocation(sky_prog, "radius"), far_parallax_radius);
+        sky_view_unif = glGetUniformLocation(sky_prog, "view");
+        sky_offset_unif = glGetUniformLocation(sky_prog, "offset");
+        sky_frustum_scale_unif = glGetUniformLocation(sky_prog, "frustumScale");
+        float corners[] = {
+            -1, -1, -1, 1, -1, -1, 1, 1, -1, -1, 1, -1,
+            -1, -1, 1, 1, -1, 1, 1, 1, 1, -1, 1, 1
+        };
+        unsigned int indices[] = {
+            0, 1, 2, 0, 2, 3, 4, 6, 5, 4, 7, 6,
+            0, 4, 5, 0, 5, 1, 3, 2, 6, 3, 6, 7,
+            0, 3, 7, 0, 7, 4, 1, 5, 6, 1, 6, 2
+        };
+        glGenVertexArrays(1, &sky_va);
+        glGenBuffers(1, &sky_vb);
+        glGenBuffers(1, &sky_eb);
+        glBindVertexArray(sky_va);
+        glBindBuffer(GL_ARRAY_BUFFER, sky_vb);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sky_eb);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
+        glEnableVertexAttribArray(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glUseProgram(restore_prog);
+    }
+
+    // Draws the stars into the six faces unless this version is baked already, leaves restore_prog current
+    void bake(const std::vector<StarInstance>& far_stars, uint64_t version, unsigned int restore_prog) {
+        if (version == baked_version)
+            return;
+        baked_version = version;
+        baked_count = std::min(far_stars.size(), capacity);
+        frame_counters.far_bakes++;
+
+        counted_bind_vertex_array(bake_va);
+        counted_bind_buffer(GL_ARRAY_BUFFER, bake_vb);
+        counted_buffer_sub_data(GL_ARRAY_BUFFER, 0, baked_count * sizeof(StarInstance), far_stars.data());
+        counted_bind_buffer(GL_ARRAY_BUFFER, 0);
+        counted_use_program(bake_prog);
+        float clear[4] = {};
+        if (gl_enabled) {
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, clear);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glViewport(0, 0, far_face_size, far_face_size);
+            glEnable(GL_PROGRAM_POINT_SIZE);
+            glEnable(GL_BLEND);
+            // Premultiplied in the texture so the skybox blends like the sprites did
+            glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            glClearColor(0, 0, 0, 0);
+        }
+        for (int face = 0; face < 6; face++) {
+            if (gl_enabled) {
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubemap, 0);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glUniformMatrix3fv(bake_view_unif, 1, GL_TRUE, far_face_rows[face]);
+            }
+            counted_draw_arrays(GL_POINTS, 0, GLsizei(baked_count));
+        }
+        counted_bind_vertex_array(0);
+        if (gl_enabled) {
+            glDisable(GL_BLEND);
+            glDisable(GL_PROGRAM_POINT_SIZE);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, WIDTH, HEIGHT);
+            glClearColor(clear[0], clear[1], clear[2], clear[3]);
+        }
+        counted_use_program(restore_prog);
+    }
+
+    // The layer moved by offset and turned by axes, then by the view, nothing before the first bake.
+    // Leaves restore_prog current
+    void draw(const float axes[9], const float offset[3], float yaw, float pitch, float frustum_scale,
+        unsigned int restore_prog) {
+        if (baked_version == 0)
+            return;
+        frame_counters.far_stars += baked_count;
+        float v[9], m[9];
+        view_rotation(yaw, pitch, v);
+        mat3_multiply(v, axes, m);
+        counted_use_program(sky_prog);
+        if (gl_enabled) {
+            glUniformMatrix3fv(sky_view_unif, 1, GL_FALSE, m);
+            glUniform1f(sky_frustum_scale_unif, frustum_scale);
+            glUniform3fv(sky_offset_unif, 1, offset);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        }
+        counted_bind_vertex_array(sky_va);
+        counted_draw_elements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        counted_bind_vertex_array(0);
+        if (gl_enabled) {
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            glDisable(GL_BLEND);
+        }
+        counted_use_program(restore_prog);
+    }
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "helper.h"
+#include "input.h"
+#include "stats.h"
+
+// Always on recorder for the last few hundred frames, dumped to a file when a frame hitches
+
+const int flight_recorder_frames = 300;
+
+struct FlightFrame {
+    uint64_t frame;
+    double frame_time;
+    FramePhases phases;
+    FrameCounters counters;
+    InputState input;
+    Position velocity;
+};
+
+class FlightRecorder {
+
+    FlightFrame frames[flight_recorder_frames];
+    uint64_t frame_count = 0;
+    // Frames to wait after a dump so one stall doesn't produce a file per frame
+    uint64_t cooldown_until = 0;
+    double hitch_factor = 2.0;
+    std::string dir = ".";
+    std::thread writer;
+
+    static void write(std::string path, std::vector<FlightFrame> snapshot, double limit) {
+        std::ofstream out(path);
+        if (!out) {
+            std::cout << "Couldn't write hitch dump to " << path << std::endl;
+            return;
+        }
+        out << "# frames over " << limit * 1000 << " ms are hitches\n";
+        out << "frame,frame_time_ms";
+        for (const char* name : phase_names)
+            out << ',' << name << "_ms";
+        out << ",draw_calls,upload_bytes,visible_stars,buttons,cursor_dx,cursor_dy,vel_x,vel_y,vel_z\n";
+        for (const FlightFrame& f : snapshot) {
+            out << f.frame << ',' << f.frame_time * 1000;
+            for (double t : f.phases.seconds)
+                out << ',' << t * 1000;
+            out << ',' << f.counters.draw_calls << ',' << f.counters.upload_bytes << ','
+                << f.counters.visible_stars << ',' << f.input.buttons << ','
+                << f.input.cursor_dx << ',' << f.input.cursor_dy << ','
+                << f.velocity.x << ',' << f.velocity.y << ',' << f.velocity.z << '\n';
+        }
+    }
+
+    // Copies the ring oldest first and hands it to a background thread so the dump doesn't cause another hitch
+    void dump(double limit) {
+        size_t n = frame_count < flight_recorder_frames ? size_t(frame_count) : flight_recorder_frames;
+        std::vector<FlightFrame> snapshot;
+        snapshot.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            snapshot.push_back(frames[(frame_count - n + i) % flight_recorder_frames]);
+
+        std::time_t now = std::time(nullptr);
+        char stamp[32];
+        std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", std::localtime(&now));
+        std::string path = dir + "/hitch_" + stamp + "_frame" + std::to_string(frame_count - 1) + ".csv";
+
+        if (writer.joinable())
+            writer.join();
+        writer = std::thread(write, path, std::move(snapshot), limit);
+    }
+
+public:
+    ~FlightRecorder() {
+        if (writer.joinable())
+            writer.join();
+    }
+
+    // A frame longer than factor times the display's refresh period triggers a dump
+    void configure(double factor, const std::string& dump_dir) {
+        hitch_factor = factor;
+        dir = dump_dir;
+    }
+
+    void record(double frame_time, const FramePhases& phases, const FrameCounters& counters,
+        const InputState& input, Position velocity) {
+        FlightFrame& f = frames[frame_count % flight_recorder_frames];
+        f.frame = frame_count;
+        f.frame_time = frame_time;
+        f.phases = phases;
+        f.counters = counters;
+        f.input = input;
+        f.velocity = velocity;
+        frame_count++;
+
+        double limit = hitch_factor * refresh_period;
+        if (hitch_factor > 0 && frame_time > limit && frame_count >= cooldown_until) {
+            dump(limit);
+            cooldown_until = frame_count + flight_recorder_frames / 2;
+        }
+    }
+};
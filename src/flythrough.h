@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "helper.h"
+#include "starfield.h"
+
+// Scripted camera for repeatable benchmark runs.
+// A script is one keyframe per line: frame vx vy vz pitch yaw roll, rotations in degrees per frame.
+// Lines starting with # are comments. Keyframes are joined with a Catmull-Rom spline
+
+struct CameraKey {
+    double frame;
+    Position velocity;
+    float pitch, yaw, roll;
+};
+
+class CameraPath {
+
+    std::vector<CameraKey> keys;
+
+    static float spline(float p0, float p1, float p2, float p3, float u) {
+        return 0.5f * (2 * p1 + (p2 - p0) * u + (2 * p0 - 5 * p1 + 4 * p2 - p3) * u * u
+            + (3 * p1 - p0 - 3 * p2 + p3) * u * u * u);
+    }
+
+public:
+    // Cruise forward, speed up while turning, drift and roll, back up and stop
+    static CameraPath default_path() {
+        CameraPath path;
+        path.keys = {
+            { 0, { 0, 0, -1, 1 }, 0, 0, 0 },
+            { 240, { 0, 0, -4, 1 }, 0, 0.3f, 0 },
+            { 600, { 1, 0.5f, -2, 1 }, 0.2f, 0, 0.3f },
+            { 900, { 0, 0, 3, 1 }, 0, -0.4f, 0 },
+            { 1200, { 0, 0, 0, 1 }, 0, 0, 0 },
+        };
+        return path;
+    }
+
+    static CameraPath load(const std::string& file) {
+        std::ifstream in(file);
+        if (!in)
+            throw std::runtime_error("Couldn't open camera path " + file);
+        CameraPath path;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream ls(line);
+            CameraKey k;
+            k.velocity.w = 1;
+            if (!(ls >> k.frame >> k.velocity.x >> k.velocity.y >> k.velocity.z >> k.pitch >> k.yaw >> k.roll))
+                throw std::runtime_error("Bad camera path line: " + line);
+            path.keys.push_back(k);
+        }
+        if (path.keys.empty())
+            throw std::runtime_error("Camera path " + file + " has no keyframes");
+        std::sort(path.keys.begin(), path.keys.end(),
+            [](const CameraKey& a, const CameraKey& b) { return a.frame < b.frame; });
+        return path;
+    }
+
+    // Holds the first and last keyframe outside of the path
+    CameraKey at(double frame) const {
+        if (frame <= keys.front().frame)
+            return keys.front();
+        if (frame >= keys.back().frame)
+            return keys.back();
+
+        size_t i = 0;
+        while (keys[i + 1].frame <= frame)
+            i++;
+        const CameraKey& k0 = keys[i > 0 ? i - 1 : 0];
+        const CameraKey& k1 = keys[i];
+        const CameraKey& k2 = keys[i + 1];
+        const CameraKey& k3 = keys[std::min(i + 2, keys.size() - 1)];
+        float u = float((frame - k1.frame) / (k2.frame - k1.frame));
+
+        CameraKey k;
+        k.frame = frame;
+        k.velocity.x = spline(k0.velocity.x, k1.velocity.x, k2.velocity.x, k3.velocity.x, u);
+        k.velocity.y = spline(k0.velocity.y, k1.velocity.y, k2.velocity.y, k3.velocity.y, u);
+        k.velocity.z = spline(k0.velocity.z, k1.velocity.z, k2.velocity.z, k3.velocity.z, u);
+        k.velocity.w = 1;
+        k.pitch = spline(k0.pitch, k1.pitch, k2.pitch, k3.pitch, u);
+        k.yaw = spline(k0.yaw, k1.yaw, k2.yaw, k3.yaw, u);
+        k.roll = spline(k0.roll, k1.roll, k2.roll, k3.roll, u);
+        return k;
+    }
+};
+
+// Does what process_input would do for the same motion, in the same order
+void apply_camera(Starfield& field, const CameraKey& k) {
+    field.set_velocity(k.velocity);
+    if (k.roll != 0)
+        field.rotate_around_z(k.roll);
+    if (k.yaw != 0)
+        field.rotate_around_y(k.yaw);
+    if (k.pitch != 0)
+        field.rotate_around_x(k.pitch);
+}
+
+// Distribution of the frame times of a run
+void print_frame_time_report(std::vector<double> times, std::ostream& os) {
+    if (times.empty())
+        return;
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (double t : times)
+        sum += t;
+    double mean = sum / times.size();
+    double var = 0;
+    for (double t : times)
+        var += (t - mean) * (t - mean);
+    auto pct = [&](double p) {
+        return times[std::min(times.size() - 1, size_t(p * times.size()))];
+    };
+
+    os << "flythrough frames: " << times.size() << "\n"
+        << "  mean (ms): " << mean * 1000 << "\n"
+        << "  stddev (ms): " << std::sqrt(var / times.size()) * 1000 << "\n"
+        << "  min (ms): " << times.front() * 1000 << "\n"
+        << "  median (ms): " << pct(0.5) * 1000 << "\n"
+        << "  p95 (ms): " << pct(0.95) * 1000 << "\n"
+        << "  p99 (ms): " << pct(0.99) * 1000 << "\n"
+        << "  max (ms): " << times.back() * 1000 << "\n";
+}
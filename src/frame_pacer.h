@@ -0,0 +1,36 @@
+#pragma once
+#include <algorithm>
+
+// Starts each frame as late as the recent render cost allows, so input is sampled
+// as close as possible to the frame being shown
+
+const int pacer_history = 30;
+// Headroom on top of the worst recent frame, in seconds
+const double pacer_margin = 0.001;
+
+class FramePacer {
+
+    double costs[pacer_history] = {};
+    int next = 0, count = 0;
+
+public:
+    // Time from the start of a frame until it was handed to the swap
+    void add_cost(double seconds) {
+        costs[next] = seconds;
+        next = (next + 1) % pacer_history;
+        count = std::min(count + 1, pacer_history);
+    }
+
+    // Worst recent cost plus a quarter and the margin, a whole period until there is history
+    double predicted_cost(double period) const {
+        if (count == 0)
+            return period;
+        double worst = *std::max_element(costs, costs + count);
+        return std::min(worst * 1.25 + pacer_margin, period);
+    }
+
+    // When the present returned the next deadline is one period away, start just early enough to make it
+    double next_start(double present_time, double period) const {
+        return present_time + period - predicted_cost(period);
+    }
+};
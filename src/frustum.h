@@ -0,0 +1,88 @@
+#pragma once
+#include <cmath>
+#include "helper.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+// How much wider than the picture the cull is, covers what the late latched view turns in
+const float cull_guard = 1.05f;
+
+// View volume of the star shader in camera space, before the view rotation.
+// Each plane keeps the points with a x + b y + c z + d >= 0
+struct Frustum {
+    static const int planes = 6;
+    float a[planes], b[planes], c[planes], d[planes];
+    // Length of (a, b, c), a sphere of radius r is inside while the plane distance is >= -r * len
+    float len[planes];
+    // Projection scale it was made from, 1 / tan(fov / 2)
+    float scale;
+
+    // Same projection as the vertex shader. guard widens the sides a little so stars the late latched
+    // view turns into the picture are already there
+    static Frustum from_projection(float frustum_scale, float aspect, float z_near, float z_far, float guard) {
+        float sx = frustum_scale / aspect / guard, sy = frustum_scale / guard;
+        // The shader's depth mapping puts the near clip plane here, not at z_near
+        float clip_near = z_near * z_far / (2 * z_far - z_near);
+        Frustum f;
+        f.scale = frustum_scale;
+        f.set(0, sx, 0, 1, 0);
+        f.set(1, -sx, 0, 1, 0);
+        f.set(2, 0, sy, 1, 0);
+        f.set(3, 0, -sy, 1, 0);
+        f.set(4, 0, 0, 1, -clip_near);
+        f.set(5, 0, 0, -1, z_far);
+        return f;
+    }
+
+    void set(int i, float pa, float pb, float pc, float pd) {
+        a[i] = pa;
+        b[i] = pb;
+        c[i] = pc;
+        d[i] = pd;
+        len[i] = std::sqrt(pa * pa + pb * pb + pc * pc);
+    }
+
+    bool contains(Position p, float r) const {
+        for (int i = 0; i < planes; i++) {
+            if (a[i] * p.x + b[i] * p.y + c[i] * p.z + d[i] < -r * len[i])
+                return false;
+        }
+        return true;
+    }
+
+    // Where a box is compared to the frustum
+    enum Overlap { OUTSIDE, INSIDE, INTERSECTS };
+
+    Overlap classify_box(const float lo[3], const float hi[3]) const {
+        Overlap result = INSIDE;
+        for (int i = 0; i < planes; i++) {
+            // Corner furthest along the plane normal, and the one furthest against it
+            float far_side = a[i] * (a[i] >= 0 ? hi[0] : lo[0]) + b[i] * (b[i] >= 0 ? hi[1] : lo[1])
+                + c[i] * (c[i] >= 0 ? hi[2] : lo[2]) + d[i];
+            if (far_side < 0)
+                return OUTSIDE;
+            float near_side = a[i] * (a[i] >= 0 ? lo[0] : hi[0]) + b[i] * (b[i] >= 0 ? lo[1] : hi[1])
+                + c[i] * (c[i] >= 0 ? lo[2] : hi[2]) + d[i];
+            if (near_side < 0)
+                result = INTERSECTS;
+        }
+        return result;
+    }
+
+#ifdef FRUSTUM_SSE
+    // Four spheres at once, bit k of the result is set when sphere k is at least partly inside
+    int contains4(__m128 x, __m128 y, __m128 z, __m128 r) const {
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int i = 0; i < planes; i++) {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), x), _mm_mul_ps(_mm_set1_ps(b[i]), y)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(c[i]), z), _mm_set1_ps(d[i])));
+            __m128 limit = _mm_mul_ps(r, _mm_set1_ps(-len[i]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, limit));
+        }
+        return _mm_movemask_ps(inside);
+    }
+#endif
+};
@@ -0,0 +1,235 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "helper.h"
+#include "star_renderer.h"
+#include "starfield.h"
+#include "stats.h"
+
+// Creates a vertex only program whose outputs are captured interleaved with transform feedback
+static unsigned int create_feedback_shader(const std::string& vertexShader, const std::vector<const char*>& varyings) {
+    unsigned int id = glCreateProgram();
+    unsigned int vs = compile_shader(GL_VERTEX_SHADER, vertexShader);
+
+    glAttachShader(id, vs);
+    // Has to be set before linking
+    glTransformFeedbackVaryings(id, GLsizei(varyings.size()), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+
+    glLinkProgram(id);
+    glValidateProgram(id);
+
+    glDeleteShader(vs);
+
+    return id;
+}
+
+// Transform feedback pass that steps every star on the GPU: the field's turn and movement since the last pass,
+// then the same bound check as the CPU stars with a hash in place of the random engine.
+// The first pass spawns the stars the way the Starfield constructor does
+const std::string gpu_step_vs = R"glsl(
+#version 330 core
+
+layout(location = 0) in vec4 center_radius;
+layout(location = 1) in vec4 color;
+out vec4 out_center_radius;
+out vec4 out_color;
+
+uniform mat3 turn;
+uniform vec3 offset;
+uniform uint pass;
+uniform bool spawn;
+uniform float starSize;
+
+uint hash(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Between 0 and 1, different for every star, pass and salt
+float random(uint salt) {
+    return float(hash(uint(gl_VertexID) ^ hash(pass ^ hash(salt))) >> 8) / 16777216.0;
+}
+
+void main()
+{
+   if (spawn) {
+       out_center_radius = vec4(random(1u) * 5.0 - 2.5, random(2u) * 5.0 - 2.5, random(3u) * 10.0 - 5.0, starSize);
+       out_color = vec4(0.8 + random(4u) / 5.0, 0.8 + random(5u) / 5.0, 0.8 + random(6u) / 5.0, 1.0);
+       return;
+   }
+
+   vec3 p = turn * center_radius.xyz + offset;
+   vec3 far = vec3(1.0 + random(1u) * 1.5, 1.0 + random(2u) * 1.5, 1.0 + random(3u) * 4.0);
+   if (p.x <= -2.5 || p.x >= 2.5)
+       p.x = p.x <= -2.5 ? far.x : -far.x;
+   if (p.y <= -2.5 || p.y >= 2.5)
+       p.y = p.y <= -2.5 ? far.y : -far.y;
+   if (p.z < -5.0 || p.z > 5.0)
+       p.z = p.z < -5.0 ? far.z : -far.z;
+   out_center_radius = vec4(p, center_radius.w);
+   out_color = color;
+}
+)glsl";
+
+// Stars that live in two GPU buffers, each frame one step pass reads one and writes the other, then the one
+// written is drawn as instanced circles. The CPU never sees a star, so the count is only limited by GPU memory
+class GpuStarSim {
+    static const int points = 8;
+    unsigned int step_prog = 0, draw_prog = 0;
+    unsigned int star_vb[2] = {}, step_va[2] = {}, draw_va[2] = {};
+    unsigned int mesh_vb = 0, eb = 0;
+    int turn_unif = -1, offset_unif = -1, pass_unif = -1, spawn_unif = -1;
+    int view_unif = -1, frustum_scale_unif = -1;
+    size_t count;
+    // Buffer holding the stars as of the last pass
+    int current = 0;
+    uint32_t passes = 0;
+    bool spawned = false;
+    ClosedFormState last;
+
+    // Circle attributes of the draw VAO reading the stars from vb
+    void setup_draw_va(unsigned int va, unsigned int vb) {
+        counted_bind_vertex_array(va);
+        counted_bind_buffer(GL_ARRAY_BUFFER, mesh_vb);
+        counted_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, eb);
+        if (gl_enabled) {
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+            glEnableVertexAttribArray(0);
+        }
+        counted_bind_buffer(GL_ARRAY_BUFFER, vb);
+        if (gl_enabled) {
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), 0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribDivisor(1, 1);
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), (void*)offsetof(StarInstance, r));
+            glEnableVertexAttribArray(2);
+            glVertexAttribDivisor(2, 1);
+        }
+    }
+
+    // Step pass VAO reading the stars from vb, one vertex per star
+    void setup_step_va(unsigned int va, unsigned int vb) {
+        counted_bind_vertex_array(va);
+        counted_bind_buffer(GL_ARRAY_BUFFER, vb);
+        if (gl_enabled) {
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), 0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), (void*)offsetof(StarInstance, r));
+            glEnableVertexAttribArray(1);
+        }
+    }
+
+public:
+    // Needs the program that should be current afterwards since building the programs switches to them
+    GpuStarSim(size_t num_stars, unsigned int restore_prog) : count{ num_stars } {
+        float corners[points * 2];
+        unsigned int indices[(points - 2) * 3];
+        fill_circle_mesh<points>(corners, indices);
+
+        if (gl_enabled) {
+            step_prog = create_feedback_shader(gpu_step_vs, { "out_center_radius", "out_color" });
+            glUseProgram(step_prog);
+            glUniform1f(glGetUniformLocation(step_prog, "starSize"), init_star_size);
+            turn_unif = glGetUniformLocation(step_prog, "turn");
+            offset_unif = glGetUniformLocation(step_prog, "offset");
+            pass_unif = glGetUniformLocation(step_prog, "pass");
+            spawn_unif = glGetUniformLocation(step_prog, "spawn");
+
+            draw_prog = create_and_use_shaders(instanced_vs, fs);
+            glUniform1f(glGetUniformLocation(draw_prog, "zNear"), Znear);
+            glUniform1f(glGetUniformLocation(draw_prog, "zFar"), Zfar);
+            glUniform1f(glGetUniformLocation(draw_prog, "aspect"), aspect);
+            view_unif = glGetUniformLocation(draw_prog, "view");
+            frustum_scale_unif = glGetUniformLocation(draw_prog, "frustumScale");
+
+            glGenBuffers(2, star_vb);
+            glGenVertexArrays(2, step_va);
+            glGenVertexArrays(2, draw_va);
+            glGenBuffers(1, &mesh_vb);
+            glGenBuffers(1, &eb);
+        }
+        // The index buffer binding is VAO state, so the mesh goes up with a draw VAO bound
+        counted_bind_vertex_array(draw_va[0]);
+        counted_bind_buffer(GL_ARRAY_BUFFER, mesh_vb);
+        counted_buffer_data(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        counted_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, eb);
+        counted_buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        for (int b = 0; b < 2; b++) {
+            // Only ever written by the step pass
+            counted_bind_buffer(GL_ARRAY_BUFFER, star_vb[b]);
+            counted_buffer_data(GL_ARRAY_BUFFER, count * sizeof(StarInstance), nullptr, GL_DYNAMIC_COPY);
+            setup_step_va(step_va[b], star_vb[b]);
+            setup_draw_va(draw_va[b], star_vb[b]);
+        }
+        counted_bind_vertex_array(0);
+        counted_bind_buffer(GL_ARRAY_BUFFER, 0);
+        if (gl_enabled)
+            glUseProgram(restore_prog);
+    }
+
+    // Moves the stars from where the field was at the last call to state, spawns them on the first call.
+    // state can be interpolated between steps, the stars just move by less
+    void step(const ClosedFormState& state) {
+        // From the last view to the new one: p = A (A_last^T p_last + D - D_last), A turns world into view
+        float a[9], b[9], turn[9], offset[3];
+        state.turn.write_axes(a);
+        last.turn.write_axes(b);
+        float moved[3];
+        for (int k = 0; k < 3; k++)
+            moved[k] = float(state.cells[k] - last.cells[k]) * box_size[k] + (state.displacement[k] - last.displacement[k]);
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 3; col++)
+                turn[col * 3 + row] = a[row] * b[col] + a[3 + row] * b[3 + col] + a[6 + row] * b[6 + col];
+            offset[row] = a[row] * moved[0] + a[3 + row] * moved[1] + a[6 + row] * moved[2];
+        }
+        last = state;
+
+        counted_use_program(step_prog);
+        if (gl_enabled) {
+            glUniformMatrix3fv(turn_unif, 1, GL_FALSE, turn);
+            glUniform3f(offset_unif, offset[0], offset[1], offset[2]);
+            glUniform1ui(pass_unif, passes++);
+            glUniform1i(spawn_unif, !spawned);
+            glEnable(GL_RASTERIZER_DISCARD);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, star_vb[1 - current]);
+            glBeginTransformFeedback(GL_POINTS);
+        }
+        counted_bind_vertex_array(step_va[current]);
+        counted_draw_arrays(GL_POINTS, 0, GLsizei(count));
+        counted_bind_vertex_array(0);
+        if (gl_enabled) {
+            glEndTransformFeedback();
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+            glDisable(GL_RASTERIZER_DISCARD);
+        }
+        current = 1 - current;
+        spawned = true;
+    }
+
+    // Every star as the last step left it, turned by the view. Leaves restore_prog current
+    void draw(float yaw, float pitch, float frustum_scale, unsigned int restore_prog) {
+        frame_counters.visible_stars += count;
+        float v[9];
+        view_rotation(yaw, pitch, v);
+        counted_use_program(draw_prog);
+        if (gl_enabled) {
+            glUniformMatrix3fv(view_unif, 1, GL_FALSE, v);
+            glUniform1f(frustum_scale_unif, frustum_scale);
+        }
+        counted_bind_vertex_array(draw_va[current]);
+        counted_draw_elements_instanced(GL_TRIANGLES, (points - 2) * 3, GL_UNSIGNED_INT, 0, GLsizei(count));
+        counted_bind_vertex_array(0);
+        counted_use_program(restore_prog);
+    }
+
+    size_t get_star_count() const {
+        return count;
+    }
+};
@@ -6,37 +6,9 @@
 #include <cmath>
 #include <vector>
 #include <random>
+#include "stats.h"
 
 // Shaders 
-//  Vertex Shader (performs projection)
-const std::string vs = R"glsl(
-#version 330 core
-
-layout(location = 0) in vec4 position;
-layout(location = 1) in vec4 color; 
-out vec4 c_in; 
-
-uniform float zNear;
-uniform float zFar;
-uniform float frustumScale;
-uniform float aspect;
-
-void main()
-{
-   vec4 cameraPos = position;
-   vec4 clipPos;
-   
-   clipPos.xy = cameraPos.xy * frustumScale;
-   clipPos.x /= aspect;
-   clipPos.z = cameraPos.z * zFar / (zFar - zNear);
-   clipPos.z -= zNear * zFar / (zFar - zNear);
-   clipPos.w = cameraPos.z;
-    
-   gl_Position = clipPos;
-   c_in = color; 
-}
-)glsl";
-
 //  fragment Shader 
 const std::string fs = R"glsl(
 #version 330 core
@@ -53,12 +25,18 @@ const double PI = 3.14159265359;
 const double sens_x = 0.01;
 const double sens_y = 0.01;
 const double FPS = 60, frame_duration = 1 / FPS;
+// The simulation always advances in steps of this size, whatever the render rate.
+// A frame runs at most max_sim_steps, time beyond that is dropped rather than caught up
+const double sim_step = frame_duration;
+const int max_sim_steps = 5;
 const float Zfar = 5;
 const float Znear = 0.001;
 
 // Possible variables but probably constants as well
 int WIDTH, HEIGHT;
 float aspect;
+// Time between two refreshes of the display, rendering follows this
+double refresh_period = frame_duration;
 
 // variables
 float FOV = 90;
@@ -90,12 +68,6 @@ bool operator!=(Position& p1, Position& p2) {
     return !(p1 == p2);
 }
 
-// Used for data transfer to GPU
-struct Vertex {
-    Position p;
-    float r, g, b, a;
-};
-
 // Shader compiler
 static unsigned int compile_shader(unsigned int type, const std::string& source) {
     unsigned int id = glCreateShader(type);
@@ -140,6 +112,8 @@ GLFWwindow* window_init() {
     WIDTH = return_struct->width;
     HEIGHT = return_struct->height;
     aspect = float(WIDTH) / HEIGHT;
+    if (return_struct->refreshRate > 0)
+        refresh_period = 1.0 / return_struct->refreshRate;
     /* Create a windowed mode window and its OpenGL context */
     window = glfwCreateWindow(WIDTH, HEIGHT, "Hello World", glfwGetPrimaryMonitor(), NULL);
     if (!window)
@@ -148,12 +122,36 @@ GLFWwindow* window_init() {
         throw std::runtime_error("Couldnt create window");
     }
 
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
-
     /* Make the window's context current */
     glfwMakeContextCurrent(window);
+    // Present on every refresh
+    glfwSwapInterval(1);
+
+    return window;
+}
+
+// Hidden window for benchmarks, only there for the GL context
+GLFWwindow* window_init_hidden(int width, int height) {
+    if (!glfwInit())
+        throw std::runtime_error("Couldn't initialize glfw");
 
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
+    WIDTH = width;
+    HEIGHT = height;
+    aspect = float(WIDTH) / HEIGHT;
+    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Starfield benchmark", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        throw std::runtime_error("Couldnt create window");
+    }
+    glfwMakeContextCurrent(window);
+    // Don't let vsync cap the measured frame rate
+    glfwSwapInterval(0);
 
     return window;
 }
@@ -183,7 +181,7 @@ static unsigned int create_and_use_shaders(const std::string& vertexShader, cons
     glDeleteShader(fs);
 
 
-    glUseProgram(id);
+    counted_use_program(id);
 
     return id;
 }
@@ -224,116 +222,30 @@ float to_rad(float deg) {
     return deg * PI / 180;
 }
 
-template <int N>
-class Circle {
-    unsigned int va, vb, eb;
-
-    float radius;
-    Position center;
-    float red, green, blue;
-
-    Vertex vertices[N];
-    Position pos[N];
-    unsigned int indices[(N - 2) * 3];
-
-    void gen_circle(Position center, float r) {
-        float angle = 360.0f / N;
-
-
-        for (int i = 0; i < N; i++)
-        {
-            float currentAngle = angle * i;
-            pos[i].x = center.x + radius * cos(currentAngle * PI / 180);
-            pos[i].y = center.y + radius * sin(currentAngle * PI / 180);
-            pos[i].z = center.z;
-            pos[i].w = center.w;
-
-        }
-
-    }
-
-    void fill_vertices() {
-        for (size_t i = 0; i < N; i++)
-        {
-            vertices[i].p = pos[i];
-            vertices[i].r = red;
-            vertices[i].g = green;
-            vertices[i].b = blue;
-            vertices[i].a = 1.f;
-        }
-    }
-
-public:
-
-    Circle(Position center, float r, float red, float green, float blue) : center{ center }, radius{ r }
-        , red{ red }, green{ green }, blue{blue} {
-        glGenVertexArrays(1, &va);
-        glGenBuffers(1, &vb);
-        glGenBuffers(1, &eb);
-
-        glBindVertexArray(va);
-        glBindBuffer(GL_ARRAY_BUFFER, vb);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eb);
-        gen_circle(center, r);
-
-
-        int triangleCount = N - 2;
-
-        // triangles
-        for (int i = 0; i < triangleCount; i++)
-        {
-            indices[i * 3] = 0;
-            indices[i * 3 + 1] = i + 1;
-            indices[i * 3 + 2] = i + 2;
-        }
-
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_DYNAMIC_DRAW);
-
-        //  Telling open gl how to interpret vertices and enable vertex attrib
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, r));
-        glEnableVertexAttribArray(1);
-
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
-    }
-
-    void draw() {
-        if (center.z >= 0) {
-            glBindVertexArray(va);
-            glBindBuffer(GL_ARRAY_BUFFER, vb);
-            gen_circle(center, radius);
-            fill_vertices();
-            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), &vertices);
-
-            glDrawElements(GL_TRIANGLES, (N - 2) * 3, GL_UNSIGNED_INT, 0);
-
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glBindVertexArray(0);
-        }
-    }
-
-    void move_all_by(float dx, float dy, float dz) {
-        center.x += dx; center.y += dy, center.z += dz;
-    }
-
-    void move_all_to(Position p) {
-        center = p;
-    }
-
-    void resize(float dr) {
-        if (radius + dr > 0)
-        radius += dr;
-    }
-
-    Position get_center() {
-        return center;
+// A turn by yaw about y followed by pitch about x, in degrees, as a column major mat3
+void view_rotation(float yaw, float pitch, float m[9]) {
+    float c1 = cos(to_rad(yaw)), s1 = sin(to_rad(yaw));
+    float c2 = cos(to_rad(pitch)), s2 = sin(to_rad(pitch));
+    float r[9] = {
+        c1, s1 * s2, -s1 * c2,
+        0, c2, s2,
+        s1, -c1 * s2, c1 * c2
+    };
+    for (int i = 0; i < 9; i++)
+        m[i] = r[i];
+}
+
+// out = a * b, all column major mat3
+void mat3_multiply(const float a[9], const float b[9], float out[9]) {
+    for (int col = 0; col < 3; col++) {
+        for (int row = 0; row < 3; row++)
+            out[col * 3 + row] = a[row] * b[col * 3] + a[3 + row] * b[col * 3 + 1] + a[6 + row] * b[col * 3 + 2];
     }
+}
 
-    unsigned int get_va() {
-        return va;
-    }
-};
\ No newline at end of file
+void set_view_rotation(unsigned int view_unif, float yaw, float pitch) {
+    float m[9];
+    view_rotation(yaw, pitch, m);
+    if (gl_enabled)
+        glUniformMatrix3fv(view_unif, 1, GL_FALSE, m);
+}
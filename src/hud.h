@@ -0,0 +1,288 @@
+#pragma once
+#include <glad/glad.h>
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "helper.h"
+#include "stats.h"
+
+// Hud shaders, positions come in pixels
+const std::string hud_vs = R"glsl(
+#version 330 core
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 uv;
+layout(location = 2) in vec4 color;
+out vec2 uv_in;
+out vec4 c_in;
+
+uniform vec2 screen;
+
+void main()
+{
+   vec2 ndc = position / screen * 2.0 - 1.0;
+   gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+   uv_in = uv;
+   c_in = color;
+}
+)glsl";
+
+const std::string hud_fs = R"glsl(
+#version 330 core
+in vec2 uv_in;
+in vec4 c_in;
+out vec4 color;
+
+uniform sampler2D atlas;
+
+void main(){
+    color = vec4(c_in.rgb, c_in.a * texture(atlas, uv_in).r);
+}
+)glsl";
+
+// 5x7 font for ascii 32 to 90, one byte per column, bit 0 is the top row
+const unsigned char hud_font[][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+    { 0x00, 0x00, 0x5F, 0x00, 0x00 }, // !
+    { 0x00, 0x07, 0x00, 0x07, 0x00 }, // "
+    { 0x14, 0x7F, 0x14, 0x7F, 0x14 }, // #
+    { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, // $
+    { 0x23, 0x13, 0x08, 0x64, 0x62 }, // %
+    { 0x36, 0x49, 0x55, 0x22, 0x50 }, // &
+    { 0x00, 0x05, 0x03, 0x00, 0x00 }, // '
+    { 0x00, 0x1C, 0x22, 0x41, 0x00 }, // (
+    { 0x00, 0x41, 0x22, 0x1C, 0x00 }, // )
+    { 0x08, 0x2A, 0x1C, 0x2A, 0x08 }, // *
+    { 0x08, 0x08, 0x3E, 0x08, 0x08 }, // +
+    { 0x00, 0x50, 0x30, 0x00, 0x00 }, // ,
+    { 0x08, 0x08, 0x08, 0x08, 0x08 }, // -
+    { 0x00, 0x60, 0x60, 0x00, 0x00 }, // .
+    { 0x20, 0x10, 0x08, 0x04, 0x02 }, // /
+    { 0x3E, 0x51, 0x49, 0x45, 0x3E }, // 0
+    { 0x00, 0x42, 0x7F, 0x40, 0x00 }, // 1
+    { 0x42, 0x61, 0x51, 0x49, 0x46 }, // 2
+    { 0x21, 0x41, 0x45, 0x4B, 0x31 }, // 3
+    { 0x18, 0x14, 0x12, 0x7F, 0x10 }, // 4
+    { 0x27, 0x45, 0x45, 0x45, 0x39 }, // 5
+    { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, // 6
+    { 0x01, 0x71, 0x09, 0x05, 0x03 }, // 7
+    { 0x36, 0x49, 0x49, 0x49, 0x36 }, // 8
+    { 0x06, 0x49, 0x49, 0x29, 0x1E }, // 9
+    { 0x00, 0x36, 0x36, 0x00, 0x00 }, // :
+    { 0x00, 0x56, 0x36, 0x00, 0x00 }, // ;
+    { 0x00, 0x08, 0x14, 0x22, 0x41 }, // <
+    { 0x14, 0x14, 0x14, 0x14, 0x14 }, // =
+    { 0x41, 0x22, 0x14, 0x08, 0x00 }, // >
+    { 0x02, 0x01, 0x51, 0x09, 0x06 }, // ?
+    { 0x32, 0x49, 0x79, 0x41, 0x3E }, // @
+    { 0x7E, 0x11, 0x11, 0x11, 0x7E }, // A
+    { 0x7F, 0x49, 0x49, 0x49, 0x36 }, // B
+    { 0x3E, 0x41, 0x41, 0x41, 0x22 }, // C
+    { 0x7F, 0x41, 0x41, 0x22, 0x1C }, // D
+    { 0x7F, 0x49, 0x49, 0x49, 0x41 }, // E
+    { 0x7F, 0x09, 0x09, 0x01, 0x01 }, // F
+    { 0x3E, 0x41, 0x41, 0x51, 0x32 }, // G
+    { 0x7F, 0x08, 0x08, 0x08, 0x7F }, // H
+    { 0x00, 0x41, 0x7F, 0x41, 0x00 }, // I
+    { 0x20, 0x40, 0x41, 0x3F, 0x01 }, // J
+    { 0x7F, 0x08, 0x14, 0x22, 0x41 }, // K
+    { 0x7F, 0x40, 0x40, 0x40, 0x40 }, // L
+    { 0x7F, 0x02, 0x04, 0x02, 0x7F }, // M
+    { 0x7F, 0x04, 0x08, 0x10, 0x7F }, // N
+    { 0x3E, 0x41, 0x41, 0x41, 0x3E }, // O
+    { 0x7F, 0x09, 0x09, 0x09, 0x06 }, // P
+    { 0x3E, 0x41, 0x51, 0x21, 0x5E }, // Q
+    { 0x7F, 0x09, 0x19, 0x29, 0x46 }, // R
+    { 0x46, 0x49, 0x49, 0x49, 0x31 }, // S
+    { 0x01, 0x01, 0x7F, 0x01, 0x01 }, // T
+    { 0x3F, 0x40, 0x40, 0x40, 0x3F }, // U
+    { 0x1F, 0x20, 0x40, 0x20, 0x1F }, // V
+    { 0x7F, 0x20, 0x18, 0x20, 0x7F }, // W
+    { 0x63, 0x14, 0x08, 0x14, 0x63 }, // X
+    { 0x03, 0x04, 0x78, 0x04, 0x03 }, // Y
+    { 0x61, 0x51, 0x49, 0x45, 0x43 }, // Z
+};
+
+const int hud_glyph_count = sizeof(hud_font) / sizeof(hud_font[0]);
+// Glyph cells are 6x8 so glyphs don't bleed into each other, the last cell is solid for boxes
+const int hud_cell_w = 6, hud_cell_h = 8;
+const int hud_solid_cell = hud_glyph_count;
+const int hud_atlas_w = (hud_glyph_count + 1) * hud_cell_w;
+const int hud_scale = 2;
+const int hud_graph_frames = 120;
+
+// Performance overlay, everything is batched into a single draw call.
+// It talks to GL directly so it doesn't show up in the counters it displays
+class Hud {
+
+    struct HudVertex {
+        float x, y, u, v;
+        unsigned char r, g, b, a;
+    };
+
+    unsigned int prog, va, vb, atlas;
+    int screen_unif;
+    bool visible = false;
+    std::vector<HudVertex> verts;
+
+    void quad(float x, float y, float w, float h, int cell, unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
+        float u0 = float(cell * hud_cell_w) / hud_atlas_w;
+        float u1 = float(cell * hud_cell_w + hud_cell_w) / hud_atlas_w;
+        float v0 = 0, v1 = 1;
+        // Sample the middle of the solid cell so filtering never reaches a neighbour
+        if (cell == hud_solid_cell) {
+            u0 = u1 = (cell * hud_cell_w + hud_cell_w / 2.f) / hud_atlas_w;
+            v0 = v1 = 0.5f;
+        }
+        HudVertex tl{ x, y, u0, v0, r, g, b, a };
+        HudVertex tr{ x + w, y, u1, v0, r, g, b, a };
+        HudVertex bl{ x, y + h, u0, v1, r, g, b, a };
+        HudVertex br{ x + w, y + h, u1, v1, r, g, b, a };
+        verts.insert(verts.end(), { tl, bl, tr, tr, bl, br });
+    }
+
+    void text(float x, float y, const char* s) {
+        float w = hud_cell_w * hud_scale, h = hud_cell_h * hud_scale;
+        for (; *s; s++, x += w) {
+            int c = std::toupper((unsigned char)*s) - ' ';
+            if (c <= 0 || c >= hud_glyph_count)
+                continue;
+            quad(x, y, w, h, c, 230, 230, 230, 255);
+        }
+    }
+
+    void create_atlas() {
+        std::vector<unsigned char> pixels(hud_atlas_w * hud_cell_h, 0);
+        for (int g = 0; g < hud_glyph_count; g++) {
+            for (int col = 0; col < 5; col++) {
+                for (int row = 0; row < 7; row++) {
+                    if (hud_font[g][col] & (1 << row))
+                        pixels[row * hud_atlas_w + g * hud_cell_w + col] = 255;
+                }
+            }
+        }
+        for (int row = 0; row < hud_cell_h; row++) {
+            for (int col = 0; col < hud_cell_w; col++)
+                pixels[row * hud_atlas_w + hud_solid_cell * hud_cell_w + col] = 255;
+        }
+
+        glGenTextures(1, &atlas);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, hud_atlas_w, hud_cell_h, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+public:
+    // Needs the program that should be current afterwards since building the hud program switches to it
+    Hud(unsigned int restore_prog) {
+        prog = create_and_use_shaders(hud_vs, hud_fs);
+        screen_unif = glGetUniformLocation(prog, "screen");
+        glUniform1i(glGetUniformLocation(prog, "atlas"), 0);
+        create_atlas();
+
+        glGenVertexArrays(1, &va);
+        glGenBuffers(1, &vb);
+        glBindVertexArray(va);
+        glBindBuffer(GL_ARRAY_BUFFER, vb);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)offsetof(HudVertex, u));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (void*)offsetof(HudVertex, r));
+        glEnableVertexAttribArray(2);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+
+        glUseProgram(restore_prog);
+    }
+
+    void toggle() {
+        visible = !visible;
+    }
+
+    bool is_visible() {
+        return visible;
+    }
+
+    // Draws the stats of the last finished frame, leaves restore_prog current
+    void draw(const FrameStats& stats, size_t star_count, unsigned int restore_prog) {
+        if (!visible || stats.frame_count() == 0)
+            return;
+
+        verts.clear();
+        const FrameCounters& c = stats.last();
+        const FramePhases& p = stats.last_phases();
+
+        double avg = 0;
+        size_t n = std::min<size_t>(30, stats.frame_count());
+        for (size_t i = 0; i < n; i++)
+            avg += stats.frame_time_back(i);
+        avg /= n;
+
+        float line = (hud_cell_h + 2) * hud_scale;
+        float x = 10 + hud_scale * 2, y = 10 + hud_scale * 2;
+        int lines = 6 + PHASE_COUNT;
+        float panel_w = 36 * hud_cell_w * hud_scale;
+        float graph_h = 60;
+
+        // Background
+        quad(10, 10, panel_w, lines * line + graph_h + 8 * hud_scale, hud_solid_cell, 0, 0, 0, 160);
+
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "FPS %.1f  FRAME %.2f MS", avg > 0 ? 1 / avg : 0, stats.frame_time_back(0) * 1000);
+        text(x, y, buf); y += line;
+        std::snprintf(buf, sizeof(buf), "STARS %zu  VISIBLE %llu  UPDATED %llu", star_count,
+            (unsigned long long)c.visible_stars, (unsigned long long)c.updated_stars);
+        text(x, y, buf); y += line;
+        std::snprintf(buf, sizeof(buf), "DRAWS %llu  UPLOAD %.1f KB", (unsigned long long)c.draw_calls, c.upload_bytes / 1024.0);
+        text(x, y, buf); y += line;
+        std::snprintf(buf, sizeof(buf), "POINTS %llu  IMPOSTORS %llu  FAR %llu", (unsigned long long)c.point_stars,
+            (unsigned long long)c.impostors, (unsigned long long)c.far_stars);
+        text(x, y, buf); y += line;
+        std::snprintf(buf, sizeof(buf), "LATENCY %.2f MS", stats.last_latency() * 1000);
+        text(x, y, buf); y += line;
+        y += line / 2;
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            std::snprintf(buf, sizeof(buf), "%-8s %6.3f MS", phase_names[i], p.seconds[i] * 1000);
+            text(x, y, buf); y += line;
+        }
+
+        // Frame time graph, full height is two refresh periods of the display, the line marks one
+        y += line / 2;
+        float bar_w = (panel_w - 4 * hud_scale) / hud_graph_frames;
+        float budget_y = y + graph_h / 2;
+        size_t frames = std::min<size_t>(hud_graph_frames, stats.frame_count());
+        for (size_t i = 0; i < frames; i++) {
+            double t = stats.frame_time_back(frames - 1 - i);
+            float h = float(std::min(t / (2 * refresh_period), 1.0)) * graph_h;
+            bool late = t > refresh_period * 1.05;
+            quad(x + i * bar_w, y + graph_h - h, bar_w, h, hud_solid_cell,
+                late ? 230 : 80, late ? 80 : 200, 80, 220);
+        }
+        quad(x, budget_y, bar_w * hud_graph_frames, 1, hud_solid_cell, 255, 255, 255, 200);
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glUseProgram(prog);
+        glUniform2f(screen_unif, float(WIDTH), float(HEIGHT));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glBindVertexArray(va);
+        glBindBuffer(GL_ARRAY_BUFFER, vb);
+        glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(HudVertex), verts.data(), GL_STREAM_DRAW);
+        glDrawArrays(GL_TRIANGLES, 0, (GLsizei)verts.size());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glDisable(GL_BLEND);
+        glUseProgram(restore_prog);
+    }
+};
@@ -0,0 +1,149 @@
+#pragma once
+#include <GLFW/glfw3.h>
+#include <atomic>
+#include <cstdint>
+#include "helper.h"
+
+// Keys and buttons process_input cares about, one bit each
+enum InputBit : uint32_t {
+    INPUT_MOUSE_LEFT = 1 << 0,
+    INPUT_MOUSE_RIGHT = 1 << 1,
+    INPUT_MOUSE_MIDDLE = 1 << 2,
+    INPUT_KEY_W = 1 << 3,
+    INPUT_KEY_A = 1 << 4,
+    INPUT_KEY_S = 1 << 5,
+    INPUT_KEY_D = 1 << 6,
+    INPUT_KEY_Q = 1 << 7,
+    INPUT_KEY_E = 1 << 8,
+    INPUT_KEY_1 = 1 << 9,
+    INPUT_KEY_2 = 1 << 10,
+    INPUT_KEY_H = 1 << 11,
+    INPUT_KEY_ESCAPE = 1 << 12
+};
+
+// Everything process_input consumes in one frame
+struct InputState {
+    uint32_t buttons = 0;
+    // Mouse movement since the last frame in pixels
+    double cursor_dx = 0, cursor_dy = 0;
+
+    bool has(InputBit b) const {
+        return (buttons & b) != 0;
+    }
+};
+
+// Mouse motion as it arrives from the cursor callback, several events per frame on fast mice.
+// Single producer single consumer ring so the callback never blocks whoever drains it
+const int mouse_queue_size = 256;
+
+class MouseDeltaQueue {
+
+    struct Delta {
+        double dx, dy;
+    };
+
+    Delta ring[mouse_queue_size];
+    std::atomic<uint32_t> head{ 0 }, tail{ 0 };
+    // Producer side only, motion that didn't fit waits here for the next event
+    double pending_dx = 0, pending_dy = 0;
+
+public:
+    void push(double dx, double dy) {
+        dx += pending_dx;
+        dy += pending_dy;
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == mouse_queue_size) {
+            pending_dx = dx;
+            pending_dy = dy;
+            return;
+        }
+        ring[h % mouse_queue_size] = { dx, dy };
+        head.store(h + 1, std::memory_order_release);
+        pending_dx = pending_dy = 0;
+    }
+
+    // Sums everything queued since the last drain
+    void drain(double& dx, double& dy) {
+        dx = dy = 0;
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        for (; t != h; t++) {
+            dx += ring[t % mouse_queue_size].dx;
+            dy += ring[t % mouse_queue_size].dy;
+        }
+        tail.store(t, std::memory_order_release);
+    }
+};
+
+MouseDeltaQueue mouse_deltas;
+
+// Last cursor position seen by the callback, the cursor is disabled so this is unbounded
+bool cursor_seen = false;
+double cursor_last_x, cursor_last_y;
+
+void cursor_callback(GLFWwindow*, double x, double y) {
+    if (cursor_seen) {
+        // Same sign as the old distance from the screen centre
+        mouse_deltas.push(cursor_last_x - x, cursor_last_y - y);
+    }
+    cursor_seen = true;
+    cursor_last_x = x;
+    cursor_last_y = y;
+}
+
+// Disabled cursor with raw motion where the platform has it, no more warping back to the centre
+void install_mouse_input(GLFWwindow* window) {
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    if (glfwRawMouseMotionSupported())
+        glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+    glfwSetCursorPosCallback(window, cursor_callback);
+}
+
+// Motion taken by latch_mouse that the simulation hasn't seen yet, read_input hands it over
+double latched_dx = 0, latched_dy = 0;
+
+// Takes the motion queued since read_input for the view, returns everything not yet simulated
+void latch_mouse(double& dx, double& dy) {
+    double new_dx, new_dy;
+    mouse_deltas.drain(new_dx, new_dy);
+    latched_dx += new_dx;
+    latched_dy += new_dy;
+    dx = latched_dx;
+    dy = latched_dy;
+}
+
+// Samples the keyboard and the mouse buttons from glfw and takes the mouse motion queued since the last call
+InputState read_input(GLFWwindow* window) {
+    struct Binding {
+        int key;
+        InputBit bit;
+    };
+    const Binding keys[] = {
+        { GLFW_KEY_W, INPUT_KEY_W }, { GLFW_KEY_A, INPUT_KEY_A },
+        { GLFW_KEY_S, INPUT_KEY_S }, { GLFW_KEY_D, INPUT_KEY_D },
+        { GLFW_KEY_Q, INPUT_KEY_Q }, { GLFW_KEY_E, INPUT_KEY_E },
+        { GLFW_KEY_1, INPUT_KEY_1 }, { GLFW_KEY_2, INPUT_KEY_2 },
+        { GLFW_KEY_H, INPUT_KEY_H }, { GLFW_KEY_ESCAPE, INPUT_KEY_ESCAPE }
+    };
+    const Binding mouse[] = {
+        { GLFW_MOUSE_BUTTON_LEFT, INPUT_MOUSE_LEFT },
+        { GLFW_MOUSE_BUTTON_RIGHT, INPUT_MOUSE_RIGHT },
+        { GLFW_MOUSE_BUTTON_MIDDLE, INPUT_MOUSE_MIDDLE }
+    };
+
+    InputState in;
+    for (const Binding& b : keys) {
+        if (glfwGetKey(window, b.key) == GLFW_PRESS)
+            in.buttons |= b.bit;
+    }
+    for (const Binding& b : mouse) {
+        if (glfwGetMouseButton(window, b.key) == GLFW_PRESS)
+            in.buttons |= b.bit;
+    }
+
+    mouse_deltas.drain(in.cursor_dx, in.cursor_dy);
+    in.cursor_dx += latched_dx;
+    in.cursor_dy += latched_dy;
+    latched_dx = latched_dy = 0;
+    return in;
+}
@@ -0,0 +1,270 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "input.h"
+
+// Binary log of every InputState process_input consumed, one record per simulation step.
+// Layout: magic, version, seed, star count, update bands, drift speed, wrap mode, then records of
+//   flags byte, varint microseconds since the previous record, then the fields the flags announce.
+// Buttons are only stored when they change and cursor deltas only when non zero, so idle frames take 3-4 bytes.
+// Cursor deltas are stored as raw doubles so a replay feeds process_input the exact same values.
+// The last record is a trailer with the step count and a checksum of the final star state
+
+const char input_log_magic[4] = { 'S', 'F', 'I', 'L' };
+// 2: input is applied before the tick instead of after it
+// 3: far stars only move when the far layer is re-baked
+// 4: near stars are updated in distance bands
+// 5: every star drifts with its own velocity
+// 6: stars that leave the box respawn from a hash instead of the random engine
+// 7: the far layer is re-baked after a pixel error bound instead of a fixed distance
+// 8: the update bands are stored in the header
+// 9: the drift speed and wrap mode are stored in the header
+// 10: respawns and wraps depend on the seed
+// 11: the far layer re-bake also counts how far the far stars may have drifted
+// 12: the skybox corrects the far layer for parallax, so it's re-baked less often
+const uint32_t input_log_version = 12;
+
+enum InputLogFlag : uint8_t {
+    LOG_BUTTONS = 1 << 0,
+    LOG_CURSOR_DX = 1 << 1,
+    LOG_CURSOR_DY = 1 << 2,
+    LOG_TRAILER = 1 << 7
+};
+
+// One of the near star update bands, as --bands gives them
+struct InputLogBand {
+    float max_distance = 0;
+    uint32_t period = 1;
+};
+
+// Most bands a log may hold, anything more is a broken file
+const uint32_t input_log_max_bands = 64;
+
+struct InputLogHeader {
+    // Already converted to the engine's result type so reseeding gives back the same sequence
+    uint64_t seed = 0;
+    uint32_t num_stars = 0;
+    // The bands change which steps update which stars, so a replay needs the recorded ones
+    std::vector<InputLogBand> bands;
+    // --drift and --wrap, for the same reason
+    float max_drift = 0;
+    bool wrap = false;
+};
+
+class InputLogWriter {
+
+    std::ofstream out;
+    uint64_t last_us = 0;
+    uint32_t last_buttons = 0;
+    uint64_t frames = 0;
+
+    void put_varint(uint64_t v) {
+        while (v >= 0x80) {
+            out.put(char(v | 0x80));
+            v >>= 7;
+        }
+        out.put(char(v));
+    }
+
+    void put_u32(uint32_t v) {
+        for (int i = 0; i < 4; i++)
+            out.put(char(v >> (8 * i)));
+    }
+
+    void put_u64(uint64_t v) {
+        for (int i = 0; i < 8; i++)
+            out.put(char(v >> (8 * i)));
+    }
+
+    void put_f32(float f) {
+        uint32_t v;
+        std::memcpy(&v, &f, sizeof(v));
+        put_u32(v);
+    }
+
+    void put_f64(double d) {
+        uint64_t v;
+        std::memcpy(&v, &d, sizeof(v));
+        put_u64(v);
+    }
+
+public:
+    bool open(const std::string& path, const InputLogHeader& header) {
+        out.open(path, std::ios::binary);
+        if (!out)
+            return false;
+        out.write(input_log_magic, 4);
+        put_u32(input_log_version);
+        put_u64(header.seed);
+        put_u32(header.num_stars);
+        put_u32(uint32_t(header.bands.size()));
+        for (const InputLogBand& band : header.bands) {
+            put_f32(band.max_distance);
+            put_u32(band.period);
+        }
+        put_f32(header.max_drift);
+        out.put(char(header.wrap));
+        return true;
+    }
+
+    bool is_open() const {
+        return out.is_open();
+    }
+
+    // time is seconds since the session started
+    void write(double time, const InputState& in) {
+        uint64_t us = time > 0 ? uint64_t(time * 1e6) : 0;
+        uint8_t flags = 0;
+        if (in.buttons != last_buttons) flags |= LOG_BUTTONS;
+        if (in.cursor_dx != 0) flags |= LOG_CURSOR_DX;
+        if (in.cursor_dy != 0) flags |= LOG_CURSOR_DY;
+
+        out.put(char(flags));
+        put_varint(us >= last_us ? us - last_us : 0);
+        if (flags & LOG_BUTTONS) put_varint(in.buttons);
+        if (flags & LOG_CURSOR_DX) put_f64(in.cursor_dx);
+        if (flags & LOG_CURSOR_DY) put_f64(in.cursor_dy);
+
+        last_us = std::max(us, last_us);
+        last_buttons = in.buttons;
+        frames++;
+    }
+
+    void finish(uint64_t checksum) {
+        if (!out.is_open())
+            return;
+        out.put(char(LOG_TRAILER));
+        put_u64(frames);
+        put_u64(checksum);
+        out.close();
+    }
+};
+
+class InputLogReader {
+
+    std::ifstream in;
+    InputLogHeader head;
+    uint64_t time_us = 0;
+    uint32_t buttons = 0;
+    bool trailer = false;
+    uint64_t trailer_frames = 0, trailer_checksum = 0;
+
+    bool get_varint(uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = in.get();
+            if (c == EOF)
+                return false;
+            v |= uint64_t(c & 0x7F) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool get_u32(uint32_t& v) {
+        unsigned char b[4];
+        if (!in.read((char*)b, 4))
+            return false;
+        v = b[0] | (b[1] << 8) | (b[2] << 16) | (uint32_t(b[3]) << 24);
+        return true;
+    }
+
+    bool get_u64(uint64_t& v) {
+        unsigned char b[8];
+        if (!in.read((char*)b, 8))
+            return false;
+        v = 0;
+        for (int i = 7; i >= 0; i--)
+            v = (v << 8) | b[i];
+        return true;
+    }
+
+    bool get_f32(float& f) {
+        uint32_t v;
+        if (!get_u32(v))
+            return false;
+        std::memcpy(&f, &v, sizeof(f));
+        return true;
+    }
+
+    bool get_f64(double& d) {
+        uint64_t v;
+        if (!get_u64(v))
+            return false;
+        std::memcpy(&d, &v, sizeof(d));
+        return true;
+    }
+
+public:
+    bool open(const std::string& path) {
+        in.open(path, std::ios::binary);
+        char magic[4];
+        uint32_t version;
+        if (!in || !in.read(magic, 4) || std::memcmp(magic, input_log_magic, 4) != 0)
+            return false;
+        uint32_t band_count;
+        if (!get_u32(version) || version != input_log_version || !get_u64(head.seed) || !get_u32(head.num_stars)
+            || !get_u32(band_count) || band_count == 0 || band_count > input_log_max_bands)
+            return false;
+        head.bands.resize(band_count);
+        for (InputLogBand& band : head.bands) {
+            if (!get_f32(band.max_distance) || !get_u32(band.period) || band.period == 0)
+                return false;
+        }
+        int wrap = EOF;
+        if (!get_f32(head.max_drift) || (wrap = in.get()) == EOF)
+            return false;
+        head.wrap = wrap != 0;
+        return true;
+    }
+
+    const InputLogHeader& header() const {
+        return head;
+    }
+
+    // False once the trailer or the end of the file is reached
+    bool next(InputState& out, double& time) {
+        int flags = in.get();
+        if (flags == EOF)
+            return false;
+        if (flags & LOG_TRAILER) {
+            trailer = get_u64(trailer_frames) && get_u64(trailer_checksum);
+            return false;
+        }
+        uint64_t delta, b;
+        if (!get_varint(delta))
+            return false;
+        time_us += delta;
+        if (flags & LOG_BUTTONS) {
+            if (!get_varint(b))
+                return false;
+            buttons = uint32_t(b);
+        }
+        out = InputState{};
+        out.buttons = buttons;
+        if ((flags & LOG_CURSOR_DX) && !get_f64(out.cursor_dx))
+            return false;
+        if ((flags & LOG_CURSOR_DY) && !get_f64(out.cursor_dy))
+            return false;
+        time = time_us / 1e6;
+        return true;
+    }
+
+    bool has_trailer() const {
+        return trailer;
+    }
+
+    uint64_t recorded_frames() const {
+        return trailer_frames;
+    }
+
+    uint64_t recorded_checksum() const {
+        return trailer_checksum;
+    }
+};
@@ -1,255 +1,100 @@
 #include "helper.h"
+#include "closed_form.h"
+#include "hud.h"
+#include "far_layer.h"
+#include "flight_recorder.h"
+#include "flythrough.h"
+#include "frame_pacer.h"
+#include "frustum.h"
+#include "gpu_sim.h"
+#include "input.h"
+#include "input_log.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "profiler.h"
+#include "sim_thread.h"
+#include "star_renderer.h"
+#include "starfield.h"
+#include "task_graph.h"
 
 using namespace std;
 
-const int num_stars = 2500;
-const float init_star_size = 0.001;
-Position init_speed = { 0, 0, 0, 1 };
-const float max_speed_z = 5;
-const float max_speed_xy = 5;
-const float min_speed = 0.01;
-const float slow_down_rate = 0.90;
-const int num_points_per_circle = 10;
-
-// Generates the stars and holds main way to make movement
-class Starfield {
-
-    // Circle holds the OpenGL implementation details to get a cirle on the screen
-    // Star holds that and the implementation to get a line behind the star
-    class Star : protected Circle<num_points_per_circle> {
-
-    public:
-        // No color specified (white)
-        Star(Position center) : Circle{ center, init_star_size, 1, 1, 1 } {
-        }
-        // Complete constructor
-        Star(Position center, float r, float g, float b) : Circle{ center, init_star_size, r, g, b } {
-        }
-
-        void bound_check_logic() {
-            Position p = get_center();
-            Position new_center = p;
-
-            if (p.x <= -2.5f || p.x >= 2.5f) {
-                new_center.x = p.x <= -2.5f ? generate_xy_far() : -generate_xy_far();
-            }
-            if (p.y <= -2.5f || p.y >= 2.5f) {
-                new_center.y = p.y <= -2.5f ? generate_xy_far() : -generate_xy_far();
-
-            }
-            if (p.z < -5.f || p.z > 5.f) {
-                new_center.z = p.z < -5.f ? generate_z_far() : -generate_z_far();
-            }
-            if (p != new_center) {
-                move_all_to(new_center);
-            }
-        }
-
-        void tick(float dt, Position velocity) {
-            bound_check_logic();
-            move_all_by(velocity.x * dt, velocity.y * dt, velocity.z * dt);
-            Circle::draw();
-        }
-
-        void rotate_z(float deg) {
-            Position new_c;
-            Position curr_c = get_center();
-            new_c.x = curr_c.x * cos(to_rad(deg))
-                - curr_c.y * sin(to_rad(deg));
-            new_c.y = curr_c.x * sin(to_rad(deg)) + curr_c.y * cos(to_rad(deg));
-            new_c.z = curr_c.z;
-            new_c.w = curr_c.w;
-            move_all_to(new_c);
-        }
-
-        void rotate_x(float deg) {
-            Position new_c;
-            Position curr_c = get_center();
-            new_c.y = curr_c.y * cos(to_rad(deg))
-                - curr_c.z * sin(to_rad(deg));
-            new_c.z = curr_c.y * sin(to_rad(deg)) + curr_c.z * cos(to_rad(deg));
-            new_c.x = curr_c.x;
-            new_c.w = curr_c.w;
-            move_all_to(new_c);
-        }
-
-        void rotate_y(float deg) {
-            Position new_c;
-            Position curr_c = get_center();
-            new_c.x = curr_c.x * cos(to_rad(deg))
-                + curr_c.z * sin(to_rad(deg));
-            new_c.z = -curr_c.x * sin(to_rad(deg)) + curr_c.z * cos(to_rad(deg));
-            new_c.y = curr_c.y;
-            new_c.w = curr_c.w;
-            move_all_to(new_c);
-        }
-
-        void resize(float dr) {
-            Circle::resize(dr);
-        }
-    };
-
-    vector<Star*> stars;
-    Position field_velocity;
-    bool slowing_down = false;
-public:
-    Starfield(int num_stars, Position vel) : field_velocity{ vel } {
-
-        for (size_t i = 0; i < num_stars; i++)
-        {
-            // Generate random position in x, y, z
-            Position ran_pos{ generate_xy(),
-            generate_xy(),
-            generate_z(),
-            1 };
-
-            // Make new star with pastel colors
-            Star* star = new Star(ran_pos, 0.8 + generate_color() / 5
-                , 0.8 + generate_color() / 5, 0.8 + generate_color() / 5);
-            // Push back into star vector 
-            stars.push_back(star);
-        }
-    }
-
-    void tick(float dt) {
-        if (slowing_down && get_speed() >= min_speed) {
-            field_velocity.x *= slow_down_rate;
-            field_velocity.y *= slow_down_rate;
-            field_velocity.z *= slow_down_rate;
-        }
-        else if (slowing_down && get_speed() < min_speed) {
-            field_velocity.x = 0;
-            field_velocity.y = 0;
-            field_velocity.z = 0;
-            slowing_down = false;
-        }
-        for (Star* s : stars) {
-            s->tick(dt, field_velocity);
-        }
-    }
-
-    void rotate_around_x(float deg) {
-        for (Star* s : stars) {
-            s->rotate_x(deg);
-        }
-    }
-
-    void rotate_around_y(float deg) {
-        for (Star* s : stars) {
-            s->rotate_y(deg);
-        }
-    }
-
-    void rotate_around_z(float deg) {
-        for (Star* s : stars) {
-            s->rotate_z(deg);
-        }
-    }
-
-    void resize_all(float dr) {
-        for (Star* s : stars) {
-            s->resize(dr);
-        }
-    }
-
-    void set_velocity(Position vel) {
-        field_velocity = vel;
-    }
-
-    Position get_velocity() {
-        return field_velocity;
-    }
-
-    Position& get_velocity_ref() {
-        return field_velocity;
-    }
-
-    float get_speed() {
-        return sqrt(field_velocity.x * field_velocity.x + field_velocity.y * field_velocity.y + field_velocity.z * field_velocity.z);
-    }
-
-    void set_slowing_down(bool b) {
-        slowing_down = b;
+// The part of the input that isn't simulation state, render thread only
+void process_window_input(GLFWwindow* window, const InputState& in, Hud* hud) {
+    if (in.has(INPUT_KEY_ESCAPE) && window) {
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
     }
 
-    bool get_slowing_down() {
-        return slowing_down;
+    // Toggle once per key press
+    static bool hud_key_down = false;
+    if (in.has(INPUT_KEY_H) && !hud_key_down && hud) {
+        hud->toggle();
     }
+    hud_key_down = in.has(INPUT_KEY_H);
+}
 
-};
-
-void process_input(GLFWwindow* window, Starfield& field) {
+// window and hud can be null when running headless or on the simulation thread
+void process_input(GLFWwindow* window, const InputState& in, Starfield& field, Hud* hud) {
     // if we are slowing down then dont process inputs for speed
     if (!field.get_slowing_down()) {
-        if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS &&
+        if (in.has(INPUT_MOUSE_LEFT) &&
             field.get_velocity().z >= -max_speed_z) {
             field.get_velocity_ref().z -= 0.01;
         }
-        if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS
+        if (in.has(INPUT_MOUSE_RIGHT)
             && field.get_velocity().z <= max_speed_z) {
             field.get_velocity_ref().z += 0.01;
         }
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS
+        if (in.has(INPUT_KEY_A)
             && field.get_velocity().x <= max_speed_xy) {
             field.get_velocity_ref().x += 0.01;
 
         }
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS
+        if (in.has(INPUT_KEY_D)
             && field.get_velocity().x >= -max_speed_xy) {
             field.get_velocity_ref().x -= 0.01;
         }
-        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS
+        if (in.has(INPUT_KEY_S)
             && field.get_velocity().y <= max_speed_xy) {
             field.get_velocity_ref().y += 0.01;
 
         }
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS
+        if (in.has(INPUT_KEY_W)
             && field.get_velocity().y >= -max_speed_xy) {
             field.get_velocity_ref().y -= 0.01;
         }
     }
     
-    if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS) {
+    if (in.has(INPUT_MOUSE_MIDDLE)) {
         field.set_slowing_down(true);
     }
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
+    if (in.has(INPUT_KEY_Q)) {
         field.rotate_around_z(0.5);
     }
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
+    if (in.has(INPUT_KEY_E)) {
 
         field.rotate_around_z(-0.5);
     }
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
-        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    if (window || hud) {
+        process_window_input(window, in, hud);
     }
 
     // Not sure if i wanna keep this resize part
-    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS) {
+    if (in.has(INPUT_KEY_2)) {
 
         field.resize_all(0.0005);
     }
-    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS) {
+    if (in.has(INPUT_KEY_1)) {
 
         field.resize_all(-0.0005);
     }
 
-    // This is all back in the yucky pixel coordinate system
-    double dx, dy;
-    glfwGetCursorPos(window, &dx, &dy);
-
-    dx = (WIDTH / 2) - dx;
-    dy = (HEIGHT / 2) - dy;
-    field.rotate_around_y(dx * sens_x);
-    field.rotate_around_x(dy * sens_y);
+    field.rotate_around_y(in.cursor_dx * sens_x);
+    field.rotate_around_x(in.cursor_dy * sens_y);
 }
 
-int main() {
-	GLFWwindow* window = window_init();
-	load_OpenGL();
-	unsigned int prog = create_and_use_shaders(vs, fs);
-
-
-
+// Sets the projection uniforms that never change and returns where the frustum scale goes
+unsigned int setup_projection(unsigned int prog) {
     unsigned int frustumScaleUnif = glGetUniformLocation(prog, "frustumScale");
     unsigned int zNearUnif = glGetUniformLocation(prog, "zNear");
     unsigned int zFarUnif = glGetUniformLocation(prog, "zFar");
@@ -259,40 +104,566 @@ int main() {
     glUniform1f(zNearUnif, Znear);
     glUniform1f(zFarUnif, Zfar);
     glUniform1f(aspectUnif, aspect);
+    set_view_rotation(glGetUniformLocation(prog, "view"), 0, 0);
+    return frustumScaleUnif;
+}
+
+// What the star shader will draw with the field of view of that speed
+Frustum frustum_at(float speed) {
+    return Frustum::from_projection(1. / tanf((fov_at(speed) * PI / 180) / 2), aspect, Znear, Zfar, cull_guard);
+}
+
+// Widens the field of view with speed
+void update_fov(float speed, unsigned int frustumScaleUnif) {
+    FOV = fov_at(speed);
+    f = 1. / tanf((FOV * PI / 180) / 2);
+    if (gl_enabled)
+        glUniform1f(frustumScaleUnif, f);
+}
+
+// Sends the circles and the sprites of a built frame
+void upload_build(const FrameBuild& build, CircleLodRenderer& renderer, SpriteRenderer& sprites) {
+    renderer.upload(build.instances.data(), build.circle_offset, build.circle_count);
+    sprites.upload(build.sprites.data(), build.point_count + build.impostor_count);
+    frame_counters.visible_stars += build.visible_count;
+    frame_counters.point_stars += build.point_count;
+    frame_counters.impostors += build.impostor_count;
+}
+
+// Culls, packs and draws the field as it is, everything on the calling thread.
+// In closed form or with the GPU simulation there's nothing to cull or pack, closed or gpu draws every star
+void render_serial(Starfield& field, StarSnapshot& snap, FrameBuild& build, CircleLodRenderer& renderer,
+    SpriteRenderer& sprites, FarLayer& far, ClosedFormRenderer* closed, GpuStarSim* gpu, unsigned int prog) {
+    field.write_snapshot(snap);
+    frame_counters.updated_stars += snap.updated_stars;
+    if (closed) {
+        closed->draw(snap.closed, 1, 0, 0, f, prog);
+        return;
+    }
+    if (gpu) {
+        gpu->step(snap.closed);
+        gpu->draw(0, 0, f, prog);
+        return;
+    }
+    field.cull_chunk(snap, 1, frustum_at(field.get_speed()), build, 0, 1);
+    field.build_chunk(snap, build, 0, 1);
+    upload_build(build, renderer, sprites);
+    far.bake(*snap.far_layer, snap.far_version, prog);
+    far.draw(snap.far_axes, snap.far_offset, 0, 0, f, prog);
+    renderer.draw(build.circle_count);
+    sprites.draw(build.point_count + build.impostor_count, 0, 0, f, prog);
+}
+
+// Command line options
+struct Options {
+    string stats_path;
+    CounterBudget budget;
+    string profile_path;
+    int profile_hz = 1000;
+    double hitch_factor = 2.0;
+    string hitch_dir = ".";
+    string metrics_socket, metrics_file;
+    string flythrough;
+    int flythrough_frames = 1800;
+    bool headless = false;
+    bool seed_override = false;
+    unsigned int seed_value = 0;
+    string record_path, replay_path;
+    string trace_path;
+    string bands;
+    bool closed_form = false;
+    size_t gpu_stars = 0;
+    float drift = -1;
+    bool wrap = false;
+};
+
+Options parse_options(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--stats" && i + 1 < argc) {
+            opt.stats_path = argv[++i];
+        }
+        else if (arg == "--budget-draws" && i + 1 < argc) {
+            opt.budget.draw_calls = stoull(argv[++i]);
+        }
+        else if (arg == "--budget-upload" && i + 1 < argc) {
+            opt.budget.upload_bytes = stoull(argv[++i]);
+        }
+        else if (arg == "--perf-counters") {
+            perf_counters.open();
+        }
+        else if (arg == "--profile" && i + 1 < argc) {
+            opt.profile_path = argv[++i];
+        }
+        else if (arg == "--profile-hz" && i + 1 < argc) {
+            opt.profile_hz = stoi(argv[++i]);
+        }
+        else if (arg == "--hitch-factor" && i + 1 < argc) {
+            opt.hitch_factor = stod(argv[++i]);
+        }
+        else if (arg == "--hitch-dir" && i + 1 < argc) {
+            opt.hitch_dir = argv[++i];
+        }
+        else if (arg == "--metrics-socket" && i + 1 < argc) {
+            opt.metrics_socket = argv[++i];
+        }
+        else if (arg == "--metrics-file" && i + 1 < argc) {
+            opt.metrics_file = argv[++i];
+        }
+        else if (arg == "--flythrough" && i + 1 < argc) {
+            opt.flythrough = argv[++i];
+        }
+        else if (arg == "--frames" && i + 1 < argc) {
+            opt.flythrough_frames = stoi(argv[++i]);
+        }
+        else if (arg == "--headless") {
+            opt.headless = true;
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            opt.seed_override = true;
+            opt.seed_value = unsigned(stoul(argv[++i]));
+        }
+        else if (arg == "--record" && i + 1 < argc) {
+            opt.record_path = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            opt.replay_path = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            opt.trace_path = argv[++i];
+        }
+        else if (arg == "--bands" && i + 1 < argc) {
+            opt.bands = argv[++i];
+        }
+        else if (arg == "--closed-form") {
+            opt.closed_form = true;
+        }
+        else if (arg == "--drift" && i + 1 < argc) {
+            opt.drift = stof(argv[++i]);
+        }
+        else if (arg == "--wrap") {
+            opt.wrap = true;
+        }
+        else if (arg == "--gpu-sim" && i + 1 < argc) {
+            opt.gpu_stars = stoull(argv[++i]);
+        }
+    }
+    return opt;
+}
+
+// Update bands from "distance:period,distance:period,...", nearest first
+bool parse_bands(const string& text, vector<UpdateBand>& bands) {
+    vector<UpdateBand> parsed;
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ',')) {
+        UpdateBand band;
+        char colon;
+        stringstream is(item);
+        if (!(is >> band.max_distance >> colon >> band.period) || colon != ':' || band.period < 1
+            || (!parsed.empty() && band.max_distance <= parsed.back().max_distance))
+            return false;
+        parsed.push_back(band);
+    }
+    if (parsed.empty())
+        return false;
+    bands = parsed;
+    return true;
+}
+
+// Prints whether a replay ended in the same state as the recording, false on a mismatch
+bool check_replay(InputLogReader& replay, uint64_t steps, Starfield& field) {
+    if (!replay.has_trailer()) {
+        cout << "replay: " << steps << " steps, the recording has no trailer to compare against" << endl;
+        return true;
+    }
+    bool match = steps == replay.recorded_frames() && field.checksum() == replay.recorded_checksum();
+    cout << "replay: " << steps << " of " << replay.recorded_frames() << " steps, final state "
+        << (match ? "matches" : "DOES NOT match") << " the recording" << endl;
+    return match;
+}
+
+// Normal mode, runs until the window is closed. With a replay the input comes from the log
+// instead of glfw and the run stops when the log ends
+bool run_interactive(const Options& opt, FrameStats& stats, InputLogReader* replay, InputLogWriter* record) {
+	GLFWwindow* window = window_init();
+	install_mouse_input(window);
+	load_OpenGL();
+	unsigned int prog = create_and_use_shaders(instanced_vs, fs);
+    unsigned int frustumScaleUnif = setup_projection(prog);
+
+    unsigned int viewUnif = glGetUniformLocation(prog, "view");
 
 	// Set up here --------------------------------------------
-	double t1 = 0;
 	double t2 = glfwGetTime();
+	double t1 = t2 - frame_duration;
+    double next_start = t2;
     //  Background color
 	glClearColor(0.1, 0.1, 0.1, 1);
-	// StarField
+	// StarField, stepped on its own thread from here on
     Starfield field{num_stars, init_speed};
+    // The GPU simulation only needs the field's motion, which is what closed form tracks
+    if (opt.closed_form || opt.gpu_stars)
+        field.set_closed_form();
+    CircleLodRenderer renderer{ field.get_star_count() };
+    SimThread sim{ field, [](const InputState& in, Starfield& f) { process_input(nullptr, in, f, nullptr); } };
+    // Stats
+    PhaseTimer phases;
+    FramePacer pacer;
+    SpriteRenderer sprites{ field.get_star_count() + field.get_cluster_count(), prog };
+    FarLayer far{ field.get_star_count(), prog };
+    unique_ptr<ClosedFormRenderer> closed;
+    if (opt.closed_form)
+        closed = make_unique<ClosedFormRenderer>(field, prog);
+    unique_ptr<GpuStarSim> gpu;
+    if (opt.gpu_stars)
+        gpu = make_unique<GpuStarSim>(opt.gpu_stars, prog);
+    Hud hud{ prog };
+    FlightRecorder recorder;
+    recorder.configure(opt.hitch_factor, opt.hitch_dir);
+    // Cursor motion handed to the simulation so far, the snapshot says how much of it the stars show
+    double posted_x = 0, posted_y = 0;
+    InputState input;
+
+    // Frame graph: while this frame's build is uploaded and drawn on this thread,
+    // the pool culls and builds the next one from the newest snapshot
+    JobSystem jobs{ max(1, int(thread::hardware_concurrency()) - 2) };
+    int chunks = jobs.size();
+    FrameBuild builds[2];
+    field.prepare_build(builds[0], chunks);
+    field.prepare_build(builds[1], chunks);
+    int current = 0;
+    const StarSnapshot* snap = nullptr;
+    float alpha = 1;
+    Frustum frustum;
+    double latch_time = 0, present_time = 0;
+    TraceLog trace;
+
+    TaskGraph graph;
+    int input_task = graph.add("input", [&](int) {
+        phases.begin();
+        glfwPollEvents();
+        if (!replay) {
+            input = read_input(window);
+            process_window_input(window, input, &hud);
+            sim.post_input(input);
+            posted_x += input.cursor_dx;
+            posted_y += input.cursor_dy;
+        }
+        phases.mark(PHASE_INPUT);
+    }, {}, 1, true);
+    // The steps themselves run on the simulation thread, this picks up the newest one
+    int simulate_task = graph.add("simulate", [&](int) {
+        snap = &sim.latest();
+        frame_counters.updated_stars += snap->updated_stars;
+        // Between the last two steps, so motion stays smooth when the render rate isn't the step rate
+        alpha = float(min(1.0, max(0.0, (steady_seconds() - snap->time) / sim_step)));
+        FrameBuild& next = builds[1 - current];
+        next.velocity = snap->velocity;
+        next.look_x = snap->look_x;
+        next.look_y = snap->look_y;
+        next.far_layer = snap->far_layer;
+        next.far_version = snap->far_version;
+        copy(snap->far_axes, snap->far_axes + 9, next.far_axes);
+        copy(snap->far_offset, snap->far_offset + 3, next.far_offset);
+        next.closed_form = snap->closed_form;
+        next.closed = snap->closed;
+        next.alpha = alpha;
+        frustum = frustum_at(snap->speed());
+        phases.mark(PHASE_INPUT);
+    }, { input_task }, 1, true);
+    int cull_task = graph.add("cull", [&](int chunk) {
+        field.cull_chunk(*snap, alpha, frustum, builds[1 - current], chunk, chunks);
+    }, { simulate_task }, chunks);
+    graph.add("build instances", [&](int chunk) {
+        field.build_chunk(*snap, builds[1 - current], chunk, chunks);
+    }, { cull_task }, chunks);
+    int upload_task = graph.add("upload", [&](int) {
+        update_fov(builds[current].speed(), frustumScaleUnif);
+        glClear(GL_COLOR_BUFFER_BIT);
+        upload_build(builds[current], renderer, sprites);
+        // The GPU stars step here, out of the latency critical draw, to where the frame is interpolated to
+        if (gpu)
+            gpu->step(builds[current].closed.at(builds[current].alpha));
+        // Nothing is built yet on the first frame
+        if (builds[current].far_layer)
+            far.bake(*builds[current].far_layer, builds[current].far_version, prog);
+        phases.mark(PHASE_TICK);
+    }, { input_task }, 1, true);
+    int draw_task = graph.add("draw", [&](int) {
+        // Late latch: cursor motion the frame doesn't show yet turns the view right before the draws,
+        // including motion that came in after read_input, which read_input hands over next frame
+        latch_time = glfwGetTime();
+        float yaw = 0, pitch = 0;
+        if (!replay) {
+            glfwPollEvents();
+            double look_dx, look_dy;
+            latch_mouse(look_dx, look_dy);
+            yaw = float((posted_x - builds[current].look_x + look_dx) * sens_x);
+            pitch = float((posted_y - builds[current].look_y + look_dy) * sens_y);
+            set_view_rotation(viewUnif, yaw, pitch);
+        }
+        if (closed) {
+            closed->draw(builds[current].closed, builds[current].alpha, yaw, pitch, f, prog);
+        }
+        else if (gpu) {
+            gpu->draw(yaw, pitch, f, prog);
+        }
+        else {
+            far.draw(builds[current].far_axes, builds[current].far_offset, yaw, pitch, f, prog);
+            renderer.draw(builds[current].circle_count);
+            sprites.draw(builds[current].point_count + builds[current].impostor_count, yaw, pitch, f, prog);
+        }
+        phases.mark(PHASE_TICK);
+        glFinish();
+        phases.mark(PHASE_FINISH);
+        hud.draw(stats, gpu ? gpu->get_star_count() : field.get_star_count(), prog);
+        phases.mark(PHASE_HUD);
+    }, { upload_task }, 1, true);
+    graph.add("present", [&](int) {
+        pacer.add_cost(glfwGetTime() - t2);
+        glfwSwapBuffers(window);
+        phases.mark(PHASE_PRESENT);
+        present_time = glfwGetTime();
+    }, { draw_task }, 1, true);
+
+    uint64_t frames = 0;
+    // Uploads done while creating the stars are not part of any frame
+    frame_counters = FrameCounters{};
+    sim.start(replay, record);
+    jobs.take_busy_seconds();
     // -------------------------------------------------------
     
     // Game Loop ---------------------------------------------
-    while (!glfwWindowShouldClose(window))
+    while (!glfwWindowShouldClose(window) && !sim.is_finished())
     {
-        if (t2 - t1 >= frame_duration) {
-            // Resize the 
-            FOV = field.get_speed() / sqrt(2 * (max_speed_xy * max_speed_xy) + max_speed_z * max_speed_z) * 360 + 45;
-            f = 1. / tanf((FOV * PI / 180) / 2);
-            glUniform1f(frustumScaleUnif, f);
-
-            glClear(GL_COLOR_BUFFER_BIT);
-            field.tick(frame_duration);
-            glFinish();
-            process_input(window, field);
-
-            glfwSetCursorPos(window, WIDTH / 2, HEIGHT / 2);
-
-            glfwSwapBuffers(window);
-            glfwPollEvents();
+        if (t2 >= next_start) {
+            graph.run(jobs);
+            current = 1 - current;
+
+            if (!opt.trace_path.empty())
+                graph.append_trace(trace, frames);
+            if (metrics.is_running()) {
+                metrics.set_thread_pool_utilization(jobs.take_busy_seconds() / (jobs.size() * (t2 - t1)));
+                metrics.record_frame(t2 - t1, frame_counters, field.get_star_count());
+            }
+            recorder.record(t2 - t1, phases.get(), frame_counters, input, builds[1 - current].velocity);
+            stats.end_frame(t2 - t1, phases.get(), present_time - latch_time);
+            frames++;
             t1 = t2;
+            next_start = pacer.next_start(present_time, refresh_period);
         }
 
         t2 = glfwGetTime();
     }
     // -------------------------------------------------------
 
+    sim.stop();
 	terminate(window);
-}
\ No newline at end of file
+
+    if (!opt.trace_path.empty() && !trace.write(opt.trace_path))
+        cout << "Couldn't write the frame trace to " << opt.trace_path << endl;
+
+    if (record)
+        record->finish(field.checksum());
+    return replay ? check_replay(*replay, sim.get_steps(), field) : true;
+}
+
+// Replays a log as fast as possible without a window or GL context
+bool run_replay_headless(FrameStats& stats, InputLogReader& replay) {
+    gl_enabled = false;
+    WIDTH = 1920;
+    HEIGHT = 1080;
+    aspect = float(WIDTH) / HEIGHT;
+
+    Starfield field{ int(replay.header().num_stars), init_speed };
+    CircleLodRenderer renderer{ field.get_star_count() };
+    SpriteRenderer sprites{ field.get_star_count() + field.get_cluster_count(), 0 };
+    FarLayer far{ field.get_star_count(), 0 };
+    StarSnapshot snap;
+    FrameBuild build;
+    field.prepare_build(build, 1);
+    frame_counters = FrameCounters{};
+    PhaseTimer phases;
+    InputState input;
+    double time;
+    uint64_t frames = 0;
+    while (replay.next(input, time)) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        phases.begin();
+        process_input(nullptr, input, field, nullptr);
+        update_fov(field.get_speed(), 0);
+        phases.mark(PHASE_INPUT);
+        field.step(float(sim_step));
+        render_serial(field, snap, build, renderer, sprites, far, nullptr, nullptr, 0);
+        phases.mark(PHASE_TICK);
+        stats.end_frame(chrono::duration<double>(chrono::steady_clock::now() - start).count(), phases.get());
+        frames++;
+    }
+    return check_replay(replay, frames, field);
+}
+
+// Benchmark mode: scripted camera, fixed frame count and dt, no frame pacing.
+// Headless runs have no window or GL context at all, only the CPU side of each frame is timed
+void run_flythrough(const CameraPath& path, int frames, bool headless, bool closed_form, size_t gpu_stars,
+    FrameStats& stats) {
+    GLFWwindow* window = nullptr;
+    unsigned int prog = 0, frustumScaleUnif = 0;
+    if (headless) {
+        gl_enabled = false;
+        WIDTH = 1920;
+        HEIGHT = 1080;
+        aspect = float(WIDTH) / HEIGHT;
+    }
+    else {
+        window = window_init_hidden(1920, 1080);
+        load_OpenGL();
+        prog = create_and_use_shaders(instanced_vs, fs);
+        frustumScaleUnif = setup_projection(prog);
+        glClearColor(0.1, 0.1, 0.1, 1);
+    }
+
+    Starfield field{ num_stars, init_speed };
+    CircleLodRenderer renderer{ field.get_star_count() };
+    SpriteRenderer sprites{ field.get_star_count() + field.get_cluster_count(), prog };
+    FarLayer far{ field.get_star_count(), prog };
+    unique_ptr<ClosedFormRenderer> closed;
+    if (closed_form) {
+        field.set_closed_form();
+        closed = make_unique<ClosedFormRenderer>(field, prog);
+    }
+    unique_ptr<GpuStarSim> gpu;
+    if (gpu_stars) {
+        field.set_closed_form();
+        gpu = make_unique<GpuStarSim>(gpu_stars, prog);
+    }
+    StarSnapshot snap;
+    FrameBuild build;
+    field.prepare_build(build, 1);
+    frame_counters = FrameCounters{};
+    PhaseTimer phases;
+    vector<double> times;
+    for (int i = 0; i < frames; i++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        phases.begin();
+        apply_camera(field, path.at(i));
+        update_fov(field.get_speed(), frustumScaleUnif);
+        phases.mark(PHASE_INPUT);
+        if (gl_enabled)
+            glClear(GL_COLOR_BUFFER_BIT);
+        field.step(float(frame_duration));
+        render_serial(field, snap, build, renderer, sprites, far, closed.get(), gpu.get(), prog);
+        phases.mark(PHASE_TICK);
+        if (gl_enabled)
+            glFinish();
+        phases.mark(PHASE_FINISH);
+        if (window)
+            glfwSwapBuffers(window);
+        phases.mark(PHASE_PRESENT);
+
+        double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        times.push_back(t);
+        stats.end_frame(t, phases.get());
+    }
+
+    if (window)
+        terminate(window);
+    print_frame_time_report(times, cout);
+}
+
+int main(int argc, char** argv) {
+    Options opt = parse_options(argc, argv);
+    if (!opt.bands.empty() && !parse_bands(opt.bands, update_bands)) {
+        cout << "Bad --bands " << opt.bands << ", expected distance:period,... with growing distances" << endl;
+        return 2;
+    }
+    if (opt.drift >= 0)
+        max_drift = opt.drift;
+    wrap_stars = opt.wrap;
+    // Closed form never touches the stars after the start and the GPU simulation keeps them on the GPU,
+    // so there's no state a log could check
+    if ((opt.closed_form || opt.gpu_stars) && (!opt.record_path.empty() || !opt.replay_path.empty())) {
+        cout << "--closed-form and --gpu-sim can't be recorded or replayed" << endl;
+        return 2;
+    }
+    if (opt.closed_form && opt.gpu_stars) {
+        cout << "Pick one of --closed-form and --gpu-sim" << endl;
+        return 2;
+    }
+    if (!opt.profile_path.empty() && profiler.start(opt.profile_path, opt.profile_hz)) {
+        profiler.register_thread("render");
+    }
+    if (!opt.metrics_socket.empty() || !opt.metrics_file.empty()) {
+        metrics.start(opt.metrics_socket, opt.metrics_file);
+    }
+
+    // Same value the engine was constructed with unless --seed is given
+    uint64_t session_seed = opt.seed_override ? opt.seed_value : uint64_t(default_random_engine::result_type(seed));
+
+    FrameStats stats;
+    stats.set_budget(opt.budget);
+    if (!opt.stats_path.empty() && !stats.open_csv(opt.stats_path)) {
+        cout << "Couldn't write stats to " << opt.stats_path << endl;
+    }
+    bool replay_ok = true;
+    if (!opt.replay_path.empty()) {
+        InputLogReader replay;
+        if (!replay.open(opt.replay_path)) {
+            cout << "Couldn't read input log " << opt.replay_path << endl;
+            return 2;
+        }
+        eng.seed(default_random_engine::result_type(replay.header().seed));
+        if (replay.header().num_stars != num_stars) {
+            cout << "The input log was recorded with " << replay.header().num_stars << " stars" << endl;
+            return 2;
+        }
+        // The recorded bands, drift and wrap mode win over the options, like the recorded seed
+        update_bands.clear();
+        for (const InputLogBand& band : replay.header().bands)
+            update_bands.push_back({ band.max_distance, int(band.period) });
+        max_drift = replay.header().max_drift;
+        wrap_stars = replay.header().wrap;
+        replay_ok = opt.headless ? run_replay_headless(stats, replay) : run_interactive(opt, stats, &replay, nullptr);
+    }
+    else if (!opt.flythrough.empty()) {
+        eng.seed(default_random_engine::result_type(session_seed));
+        try {
+            CameraPath path = opt.flythrough == "default" ? CameraPath::default_path() : CameraPath::load(opt.flythrough);
+            run_flythrough(path, opt.flythrough_frames, opt.headless, opt.closed_form, opt.gpu_stars, stats);
+        }
+        catch (const std::exception& e) {
+            cout << e.what() << endl;
+            return 2;
+        }
+    }
+    else {
+        eng.seed(default_random_engine::result_type(session_seed));
+        InputLogWriter record;
+        InputLogHeader header;
+        header.seed = session_seed;
+        header.num_stars = uint32_t(num_stars);
+        for (const UpdateBand& band : update_bands)
+            header.bands.push_back({ band.max_distance, uint32_t(band.period) });
+        header.max_drift = max_drift;
+        header.wrap = wrap_stars;
+        if (!opt.record_path.empty() && !record.open(opt.record_path, header)) {
+            cout << "Couldn't write input log " << opt.record_path << endl;
+        }
+        run_interactive(opt, stats, nullptr, record.is_open() ? &record : nullptr);
+    }
+
+    profiler.unregister_thread();
+    profiler.stop();
+    metrics.stop();
+    stats.print_summary(cout);
+    cout << "update bands:";
+    for (const UpdateBand& band : update_bands)
+        cout << " within " << band.max_distance << " every " << band.period << (band.period == 1 ? " step" : " steps") << ",";
+    cout << " far layer past " << far_shell_radius << "\n";
+    perf_counters.print_report(cout);
+    if (!replay_ok)
+        return 3;
+    // Non zero exit so scripts can catch counter regressions
+    return stats.get_over_budget_frames() ? 1 : 0;
+}
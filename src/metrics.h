@@ -0,0 +1,233 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "stats.h"
+
+// OpenMetrics exporter. The render loop only does relaxed atomic stores and increments,
+// a separate thread formats the text for a unix socket and/or a file so scrapes never touch the frame
+
+const double metrics_buckets[] = { 0.004, 0.008, 0.0167, 0.025, 0.0334, 0.05, 0.1, 0.25 };
+const int metrics_bucket_count = sizeof(metrics_buckets) / sizeof(metrics_buckets[0]);
+
+class MetricsExporter {
+
+    // Non cumulative, the last one is +Inf
+    std::atomic<uint64_t> buckets[metrics_bucket_count + 1] = {};
+    std::atomic<double> frame_time_sum{ 0 };
+    std::atomic<double> fps{ 0 };
+    std::atomic<uint64_t> stars{ 0 };
+    std::atomic<uint64_t> visible_stars{ 0 };
+    std::atomic<uint64_t> draw_calls{ 0 };
+    std::atomic<uint64_t> upload_bytes{ 0 };
+    std::atomic<double> pool_utilization{ -1 };
+
+    // Only touched by the render thread
+    double local_sum = 0;
+    double fps_avg = 0;
+    uint64_t local_draws = 0, local_upload = 0;
+
+    std::atomic<bool> running{ false };
+    std::thread worker;
+    std::string socket_path, file_path;
+    int listen_fd = -1;
+
+    std::string format() const {
+        std::ostringstream os;
+        os << "# TYPE starfield_frame_time_seconds histogram\n"
+            << "# UNIT starfield_frame_time_seconds seconds\n"
+            << "# HELP starfield_frame_time_seconds Time between frame starts.\n";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < metrics_bucket_count; i++) {
+            cumulative += buckets[i].load(std::memory_order_relaxed);
+            os << "starfield_frame_time_seconds_bucket{le=\"" << metrics_buckets[i] << "\"} " << cumulative << "\n";
+        }
+        cumulative += buckets[metrics_bucket_count].load(std::memory_order_relaxed);
+        os << "starfield_frame_time_seconds_bucket{le=\"+Inf\"} " << cumulative << "\n"
+            << "starfield_frame_time_seconds_count " << cumulative << "\n"
+            << "starfield_frame_time_seconds_sum " << frame_time_sum.load(std::memory_order_relaxed) << "\n";
+
+        os << "# TYPE starfield_fps gauge\n"
+            << "starfield_fps " << fps.load(std::memory_order_relaxed) << "\n"
+            << "# TYPE starfield_stars gauge\n"
+            << "starfield_stars " << stars.load(std::memory_order_relaxed) << "\n"
+            << "# TYPE starfield_visible_stars gauge\n"
+            << "starfield_visible_stars " << visible_stars.load(std::memory_order_relaxed) << "\n"
+            << "# TYPE starfield_draw_calls counter\n"
+            << "starfield_draw_calls_total " << draw_calls.load(std::memory_order_relaxed) << "\n"
+            << "# TYPE starfield_upload_bytes counter\n"
+            << "# UNIT starfield_upload_bytes bytes\n"
+            << "starfield_upload_bytes_total " << upload_bytes.load(std::memory_order_relaxed) << "\n";
+        double util = pool_utilization.load(std::memory_order_relaxed);
+        if (util >= 0) {
+            os << "# TYPE starfield_thread_pool_utilization gauge\n"
+                << "starfield_thread_pool_utilization " << util << "\n";
+        }
+        os << "# EOF\n";
+        return os.str();
+    }
+
+    void write_file() const {
+        // Write then rename so readers never see half a file
+        std::string tmp = file_path + ".tmp";
+        {
+            std::ofstream out(tmp);
+            if (!out)
+                return;
+            out << format();
+        }
+        std::rename(tmp.c_str(), file_path.c_str());
+    }
+
+#ifndef _WIN32
+    bool open_socket() {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path))
+            return false;
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd == -1)
+            return false;
+        socket_path.copy(addr.sun_path, socket_path.size());
+        unlink(socket_path.c_str());
+        if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0) {
+            ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // Plain connections get the text, anything that sends an http GET gets an http response
+    void serve(int fd) const {
+        char req[512];
+        pollfd p = { fd, POLLIN, 0 };
+        ssize_t n = poll(&p, 1, 50) > 0 ? recv(fd, req, sizeof(req), 0) : 0;
+        std::string body = format();
+        std::string reply;
+        if (n >= 4 && std::string(req, 4) == "GET ") {
+            reply = "HTTP/1.0 200 OK\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        }
+        reply += body;
+        size_t sent = 0;
+        while (sent < reply.size()) {
+            ssize_t w = send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (w <= 0)
+                break;
+            sent += size_t(w);
+        }
+        ::close(fd);
+    }
+#endif
+
+    void run() {
+        auto next_write = std::chrono::steady_clock::now();
+        while (running) {
+#ifndef _WIN32
+            if (listen_fd != -1) {
+                pollfd p = { listen_fd, POLLIN, 0 };
+                if (poll(&p, 1, 200) > 0) {
+                    int fd = accept(listen_fd, nullptr, nullptr);
+                    if (fd != -1)
+                        serve(fd);
+                }
+            }
+            else
+#endif
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            }
+            if (!file_path.empty() && std::chrono::steady_clock::now() >= next_write) {
+                write_file();
+                next_write += std::chrono::seconds(1);
+            }
+        }
+    }
+
+public:
+    ~MetricsExporter() {
+        stop();
+    }
+
+    // Either path can be empty, the file is rewritten every second
+    bool start(const std::string& socket, const std::string& file) {
+        socket_path = socket;
+        file_path = file;
+        if (!socket_path.empty()) {
+#ifndef _WIN32
+            if (!open_socket()) {
+                std::cout << "Couldn't listen for metrics on " << socket_path << std::endl;
+                socket_path.clear();
+            }
+#else
+            std::cout << "Metrics over a unix socket aren't supported here" << std::endl;
+            socket_path.clear();
+#endif
+        }
+        if (socket_path.empty() && file_path.empty())
+            return false;
+        running = true;
+        worker = std::thread(&MetricsExporter::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (!running)
+            return;
+        running = false;
+        worker.join();
+#ifndef _WIN32
+        if (listen_fd != -1) {
+            ::close(listen_fd);
+            unlink(socket_path.c_str());
+            listen_fd = -1;
+        }
+#endif
+        if (!file_path.empty())
+            write_file();
+    }
+
+    bool is_running() const {
+        return running;
+    }
+
+    // Called once per frame from the render loop
+    void record_frame(double frame_time, const FrameCounters& c, size_t star_count) {
+        int b = 0;
+        while (b < metrics_bucket_count && frame_time > metrics_buckets[b])
+            b++;
+        buckets[b].fetch_add(1, std::memory_order_relaxed);
+        local_sum += frame_time;
+        frame_time_sum.store(local_sum, std::memory_order_relaxed);
+
+        if (frame_time > 0)
+            fps_avg = fps_avg == 0 ? 1 / frame_time : fps_avg * 0.95 + 0.05 / frame_time;
+        fps.store(fps_avg, std::memory_order_relaxed);
+        stars.store(star_count, std::memory_order_relaxed);
+        visible_stars.store(c.visible_stars, std::memory_order_relaxed);
+        local_draws += c.draw_calls;
+        local_upload += c.upload_bytes;
+        draw_calls.store(local_draws, std::memory_order_relaxed);
+        upload_bytes.store(local_upload, std::memory_order_relaxed);
+    }
+
+    // Fraction of time worker threads were busy, only exported once something reports it
+    void set_thread_pool_utilization(double u) {
+        pool_utilization.store(u, std::memory_order_relaxed);
+    }
+};
+
+MetricsExporter metrics;
@@ -0,0 +1,199 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware event counters (Linux only) around the simulation kernels.
+// If the kernel or the container doesn't let us open them everything turns into a no op
+
+// Parts of the simulation we count separately
+enum PerfRegion {
+    REGION_TICK,
+    REGION_BOUND_CHECK,
+    REGION_ROTATE,
+    REGION_COUNT
+};
+
+const char* region_names[REGION_COUNT] = { "tick", "bound_check", "rotate" };
+
+enum PerfEvent {
+    EVENT_CYCLES,
+    EVENT_INSTRUCTIONS,
+    EVENT_CACHE_MISSES,
+    EVENT_BRANCH_MISSES,
+    EVENT_COUNT
+};
+
+const char* event_names[EVENT_COUNT] = { "cycles", "instructions", "cache misses", "branch misses" };
+
+struct PerfReading {
+    uint64_t values[EVENT_COUNT] = {};
+};
+
+class PerfCounters {
+
+    struct RegionTotals {
+        PerfReading events;
+        uint64_t calls = 0;
+        uint64_t items = 0;
+    };
+
+    int leader = -1;
+    int fds[EVENT_COUNT] = { -1, -1, -1, -1 };
+    // Position of each event in the group read, -1 if it couldn't be opened
+    int slot[EVENT_COUNT] = { -1, -1, -1, -1 };
+    int opened = 0;
+    RegionTotals totals[REGION_COUNT];
+
+#ifdef __linux__
+    static int open_event(uint64_t config, int group_fd) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = group_fd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+#endif
+
+public:
+    ~PerfCounters() {
+        close();
+    }
+
+    // Opens the counters for the calling thread, returns false when none are available
+    bool open() {
+#ifdef __linux__
+        const uint64_t configs[EVENT_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            fds[e] = open_event(configs[e], leader);
+            if (fds[e] == -1)
+                continue;
+            if (leader == -1)
+                leader = fds[e];
+            slot[e] = opened++;
+        }
+        if (leader == -1) {
+            std::cout << "Hardware performance counters unavailable, continuing without them" << std::endl;
+            return false;
+        }
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+#else
+        std::cout << "Hardware performance counters are only supported on Linux" << std::endl;
+        return false;
+#endif
+    }
+
+    void close() {
+#ifdef __linux__
+        for (int& fd : fds) {
+            if (fd != -1)
+                ::close(fd);
+            fd = -1;
+        }
+#endif
+        // A later open that gets fewer events must not read this session's slots
+        for (int& e : slot)
+            e = -1;
+        leader = -1;
+        opened = 0;
+    }
+
+    bool enabled() const {
+        return leader != -1;
+    }
+
+    bool has(PerfEvent e) const {
+        return slot[e] != -1;
+    }
+
+    PerfReading read() const {
+        PerfReading r;
+#ifdef __linux__
+        if (leader == -1)
+            return r;
+        // Group layout is the number of events followed by their values
+        uint64_t buf[1 + EVENT_COUNT] = {};
+        if (::read(leader, buf, sizeof(buf)) <= 0)
+            return r;
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            if (slot[e] != -1)
+                r.values[e] = buf[1 + slot[e]];
+        }
+#endif
+        return r;
+    }
+
+    void add(PerfRegion region, const PerfReading& start, const PerfReading& end, uint64_t items) {
+        RegionTotals& t = totals[region];
+        for (int e = 0; e < EVENT_COUNT; e++)
+            t.events.values[e] += end.values[e] - start.values[e];
+        t.calls++;
+        t.items += items;
+    }
+
+    // IPC and per star numbers for each region
+    void print_report(std::ostream& os) const {
+        if (!enabled())
+            return;
+        os << "hardware counters:\n";
+        for (int r = 0; r < REGION_COUNT; r++) {
+            const RegionTotals& t = totals[r];
+            if (t.calls == 0)
+                continue;
+            const uint64_t* v = t.events.values;
+            double items = t.items ? double(t.items) : 1;
+            os << "  " << region_names[r] << ": calls " << t.calls;
+            if (has(EVENT_CYCLES))
+                os << ", cycles/star " << v[EVENT_CYCLES] / items;
+            if (has(EVENT_CYCLES) && has(EVENT_INSTRUCTIONS) && v[EVENT_CYCLES])
+                os << ", IPC " << double(v[EVENT_INSTRUCTIONS]) / v[EVENT_CYCLES];
+            if (has(EVENT_CACHE_MISSES))
+                os << ", cache misses/star " << v[EVENT_CACHE_MISSES] / items;
+            if (has(EVENT_BRANCH_MISSES))
+                os << ", branch misses/star " << v[EVENT_BRANCH_MISSES] / items;
+            os << "\n";
+        }
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            if (!has(PerfEvent(e)))
+                os << "  (" << event_names[e] << " not supported here)\n";
+        }
+    }
+};
+
+PerfCounters perf_counters;
+
+// Counts everything between construction and destruction into a region
+class PerfScope {
+    PerfRegion region;
+    uint64_t items;
+    PerfReading start;
+
+public:
+    PerfScope(PerfRegion region, uint64_t items) : region{ region }, items{ items } {
+        if (perf_counters.enabled())
+            start = perf_counters.read();
+    }
+
+    ~PerfScope() {
+        if (perf_counters.enabled())
+            perf_counters.add(region, start, perf_counters.read(), items);
+    }
+};
@@ -0,0 +1,268 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <csignal>
+#include <ctime>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif
+
+// Sampling profiler (Linux only). Every registered thread gets a SIGPROF timer on its own
+// cpu clock, the handler stores a backtrace in a preallocated ring and a collector thread
+// folds them into counts. On stop the stacks are written in the folded format flamegraph.pl reads
+
+const int profiler_max_depth = 48;
+const int profiler_ring_size = 4096;
+const int profiler_max_threads = 16;
+
+class Profiler {
+
+    enum SlotState { SLOT_EMPTY, SLOT_WRITING, SLOT_FULL };
+
+    struct Sample {
+        std::atomic<int> state{ SLOT_EMPTY };
+        int thread;
+        int depth;
+        void* frames[profiler_max_depth];
+    };
+
+    Sample ring[profiler_ring_size];
+    std::atomic<uint64_t> write_index{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<bool> running{ false };
+    uint64_t read_index = 0;
+
+    std::mutex threads_mutex;
+    std::string thread_names[profiler_max_threads];
+    int thread_count = 0;
+#ifdef __linux__
+    timer_t timers[profiler_max_threads];
+#endif
+    bool has_timer[profiler_max_threads] = {};
+
+    std::string out_path;
+    int hz = 1000;
+    std::thread collector;
+    // Thread index and leaf first frames mapped to sample count
+    std::map<std::vector<void*>, uint64_t> stacks;
+
+    static thread_local int thread_index;
+    static Profiler* instance;
+
+#ifdef __linux__
+    static void on_signal(int, siginfo_t*, void*) {
+        Profiler* p = instance;
+        if (!p || !p->running.load(std::memory_order_relaxed) || thread_index < 0)
+            return;
+        int saved_errno = errno;
+        uint64_t i = p->write_index.fetch_add(1, std::memory_order_relaxed);
+        Sample& s = p->ring[i % profiler_ring_size];
+        int expected = SLOT_EMPTY;
+        if (s.state.compare_exchange_strong(expected, SLOT_WRITING, std::memory_order_acquire)) {
+            s.thread = thread_index;
+            s.depth = backtrace(s.frames, profiler_max_depth);
+            s.state.store(SLOT_FULL, std::memory_order_release);
+        }
+        else {
+            p->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        errno = saved_errno;
+    }
+#endif
+
+    // Moves finished samples out of the ring, runs on the collector thread
+    void drain() {
+        uint64_t end = write_index.load(std::memory_order_acquire);
+        // Don't look further back than one ring, older slots were reused
+        if (end - read_index > profiler_ring_size)
+            read_index = end - profiler_ring_size;
+        for (; read_index < end; read_index++) {
+            Sample& s = ring[read_index % profiler_ring_size];
+            // Claimed but still being written, pick it up next time
+            if (s.state.load(std::memory_order_acquire) != SLOT_FULL)
+                break;
+            // Skip the handler and the signal trampoline
+            std::vector<void*> key;
+            key.push_back((void*)(intptr_t)s.thread);
+            for (int f = 2; f < s.depth; f++)
+                key.push_back(s.frames[f]);
+            stacks[key]++;
+            s.state.store(SLOT_EMPTY, std::memory_order_release);
+        }
+    }
+
+    static std::string symbolize(void* addr) {
+#ifdef __linux__
+        Dl_info info;
+        if (dladdr(addr, &info) && info.dli_sname) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            std::string name = status == 0 ? demangled : info.dli_sname;
+            std::free(demangled);
+            // Folded stacks use ; as separator and a space before the count
+            for (char& c : name) {
+                if (c == ';' || c == ' ')
+                    c = '_';
+            }
+            return name;
+        }
+#endif
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)(uintptr_t)addr);
+        return buf;
+    }
+
+public:
+    // Starts sampling, out is where the folded stacks go on stop
+    bool start(const std::string& out, int sample_hz) {
+#ifdef __linux__
+        out_path = out;
+        hz = sample_hz;
+        instance = this;
+
+        // backtrace allocates the first time it is used, get that out of the way outside the handler
+        void* warmup[4];
+        backtrace(warmup, 4);
+
+        struct sigaction sa = {};
+        sa.sa_sigaction = on_signal;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+            std::cout << "Couldn't install the profiler signal handler" << std::endl;
+            return false;
+        }
+
+        running = true;
+        collector = std::thread([this] {
+            while (running) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                drain();
+            }
+            drain();
+        });
+        return true;
+#else
+        (void)out; (void)sample_hz;
+        std::cout << "The sampling profiler is only supported on Linux" << std::endl;
+        return false;
+#endif
+    }
+
+    // Starts sampling the calling thread, name becomes the root frame of its stacks
+    void register_thread(const std::string& name) {
+#ifdef __linux__
+        if (!running)
+            return;
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        if (thread_count == profiler_max_threads)
+            return;
+        int index = thread_count++;
+        thread_names[index] = name;
+
+        clockid_t clock;
+        if (pthread_getcpuclockid(pthread_self(), &clock) != 0)
+            return;
+        sigevent sev = {};
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGPROF;
+        sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+        if (timer_create(clock, &sev, &timers[index]) != 0)
+            return;
+        has_timer[index] = true;
+        thread_index = index;
+
+        long interval_ns = 1000000000L / hz;
+        itimerspec spec = {};
+        spec.it_interval.tv_sec = interval_ns / 1000000000L;
+        spec.it_interval.tv_nsec = interval_ns % 1000000000L;
+        spec.it_value = spec.it_interval;
+        timer_settime(timers[index], 0, &spec, nullptr);
+#else
+        (void)name;
+#endif
+    }
+
+    // Must be called by a registered thread before it exits
+    void unregister_thread() {
+#ifdef __linux__
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        if (thread_index >= 0 && has_timer[thread_index]) {
+            timer_delete(timers[thread_index]);
+            has_timer[thread_index] = false;
+        }
+        thread_index = -1;
+#endif
+    }
+
+    bool is_running() {
+        return running;
+    }
+
+    // Stops every timer and writes the folded stacks
+    void stop() {
+#ifdef __linux__
+        if (!running)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(threads_mutex);
+            for (int i = 0; i < thread_count; i++) {
+                if (has_timer[i])
+                    timer_delete(timers[i]);
+                has_timer[i] = false;
+            }
+        }
+        running = false;
+        collector.join();
+
+        std::ofstream out(out_path);
+        if (!out) {
+            std::cout << "Couldn't write profile to " << out_path << std::endl;
+            return;
+        }
+        // Symbols are looked up once per address, not once per stack
+        std::map<void*, std::string> names;
+        uint64_t total = 0;
+        for (const auto& entry : stacks) {
+            const std::vector<void*>& key = entry.first;
+            out << thread_names[(intptr_t)key[0]];
+            for (size_t f = key.size() - 1; f >= 1; f--) {
+                auto it = names.find(key[f]);
+                if (it == names.end())
+                    it = names.emplace(key[f], symbolize(key[f])).first;
+                out << ';' << it->second;
+            }
+            out << ' ' << entry.second << '\n';
+            total += entry.second;
+        }
+        std::cout << "profile: " << total << " samples written to " << out_path;
+        if (dropped)
+            std::cout << " (" << dropped << " dropped)";
+        std::cout << std::endl;
+#endif
+    }
+};
+
+thread_local int Profiler::thread_index = -1;
+Profiler* Profiler::instance = nullptr;
+
+Profiler profiler;
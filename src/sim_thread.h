@@ -0,0 +1,178 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "helper.h"
+#include "input.h"
+#include "input_log.h"
+#include "perf_counters.h"
+#include "profiler.h"
+#include "starfield.h"
+#include "triple_buffer.h"
+
+// Steady clock in seconds, the time base shared by both threads
+double steady_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Input the render thread read, waiting for a simulation step to take it.
+// Buttons are the latest state, cursor motion adds up until a step consumes it
+class InputMailbox {
+
+    std::atomic<uint32_t> buttons{ 0 };
+    MouseDeltaQueue motion;
+
+public:
+    // Render thread
+    void post(const InputState& in) {
+        buttons.store(in.buttons, std::memory_order_release);
+        if (in.cursor_dx != 0 || in.cursor_dy != 0)
+            motion.push(in.cursor_dx, in.cursor_dy);
+    }
+
+    // Simulation thread
+    InputState take() {
+        InputState in;
+        in.buttons = buttons.load(std::memory_order_acquire);
+        motion.drain(in.cursor_dx, in.cursor_dy);
+        return in;
+    }
+};
+
+// Runs the fixed step simulation on its own thread. Every step is published through a triple buffer,
+// so a slow step never holds up the render thread and a slow frame never holds up the steps.
+// While it runs the thread owns every star's position and the field velocity, the render thread only reads snapshots
+class SimThread {
+
+    using InputHandler = void (*)(const InputState&, Starfield&);
+
+    Starfield& field;
+    InputHandler on_input;
+    InputLogReader* replay = nullptr;
+    InputLogWriter* record = nullptr;
+
+    TripleBuffer<StarSnapshot> snapshots;
+    InputMailbox mailbox;
+    std::thread worker;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> finished{ false };
+
+    uint64_t steps = 0;
+    double look_x = 0, look_y = 0;
+    double session_start = 0;
+
+    void publish() {
+        StarSnapshot& snap = snapshots.write_slot();
+        field.write_snapshot(snap);
+        snap.step = steps;
+        snap.look_x = look_x;
+        snap.look_y = look_y;
+        snap.time = steady_seconds();
+        snapshots.publish();
+    }
+
+    // Returns false when the replay ran out
+    bool step() {
+        InputState in;
+        double replay_time;
+        if (replay) {
+            if (!replay->next(in, replay_time))
+                return false;
+        }
+        else {
+            in = mailbox.take();
+        }
+        if (record)
+            record->write(steady_seconds() - session_start, in);
+        on_input(in, field);
+        field.step(float(sim_step));
+        look_x += in.cursor_dx;
+        look_y += in.cursor_dy;
+        steps++;
+        publish();
+        return true;
+    }
+
+    void run() {
+        profiler.register_thread("sim");
+        // The counters only count the thread that opened them, and every counted region runs here now
+        if (perf_counters.enabled()) {
+            perf_counters.close();
+            perf_counters.open();
+        }
+
+        double accumulator = 0;
+        double last = steady_seconds();
+        while (running.load(std::memory_order_acquire)) {
+            double now = steady_seconds();
+            accumulator += now - last;
+            last = now;
+
+            int frame_steps = 0;
+            while (accumulator >= sim_step && frame_steps < max_sim_steps) {
+                if (!step()) {
+                    running.store(false, std::memory_order_release);
+                    break;
+                }
+                accumulator -= sim_step;
+                frame_steps++;
+            }
+            // Too far behind, lose the time instead of spiralling
+            if (frame_steps == max_sim_steps)
+                accumulator = std::min(accumulator, sim_step);
+            std::this_thread::sleep_for(std::chrono::duration<double>(sim_step - accumulator));
+        }
+
+        finished.store(true, std::memory_order_release);
+        profiler.unregister_thread();
+    }
+
+public:
+    // on_input applies one input sample to the field before each step, on the simulation thread
+    SimThread(Starfield& field, InputHandler on_input) : field{ field }, on_input{ on_input } {
+    }
+
+    ~SimThread() {
+        stop();
+    }
+
+    // The replay is read and the record written on the simulation thread until stop
+    void start(InputLogReader* replay_log, InputLogWriter* record_log) {
+        replay = replay_log;
+        record = record_log;
+        session_start = steady_seconds();
+        // The renderer has something to show before the first step
+        publish();
+        running = true;
+        worker = std::thread(&SimThread::run, this);
+    }
+
+    // Waits for the thread, the field belongs to the caller again afterwards
+    void stop() {
+        running = false;
+        if (worker.joinable())
+            worker.join();
+    }
+
+    // True once a replay ran out
+    bool is_finished() const {
+        return finished.load(std::memory_order_acquire);
+    }
+
+    // Render thread
+    void post_input(const InputState& in) {
+        mailbox.post(in);
+    }
+
+    // Render thread, the newest complete step without waiting
+    const StarSnapshot& latest() {
+        snapshots.update();
+        return snapshots.read_slot();
+    }
+
+    // Only meaningful after stop
+    uint64_t get_steps() const {
+        return steps;
+    }
+};
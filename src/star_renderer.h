@@ -0,0 +1,272 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include "helper.h"
+#include "stats.h"
+
+// Per star data of the instanced draw
+struct StarInstance {
+    float x, y, z, radius;
+    float r, g, b, a;
+};
+
+// Circle meshes stars are drawn with, each star gets the level its projected radius needs
+const int circle_lod_count = 4;
+constexpr int circle_lod_points[circle_lod_count] = { 4, 8, 16, 32 };
+// A star takes the first level whose limit, in pixels of projected radius, it is under
+const float circle_lod_max_pixels[circle_lod_count - 1] = { 2, 6, 16 };
+
+int circle_lod_for(float radius_pixels) {
+    int level = 0;
+    while (level < circle_lod_count - 1 && radius_pixels >= circle_lod_max_pixels[level])
+        level++;
+    return level;
+}
+
+// Instanced vertex shader: a unit circle moved and scaled per star, then the same projection for every star
+const std::string instanced_vs = R"glsl(
+#version 330 core
+
+layout(location = 0) in vec2 corner;
+layout(location = 1) in vec4 center_radius;
+layout(location = 2) in vec4 color;
+out vec4 c_in;
+
+uniform float zNear;
+uniform float zFar;
+uniform float frustumScale;
+uniform float aspect;
+uniform mat3 view;
+
+void main()
+{
+   vec3 world = vec3(center_radius.xy + corner * center_radius.w, center_radius.z);
+   vec4 cameraPos = vec4(view * world, 1.0);
+   vec4 clipPos;
+
+   clipPos.xy = cameraPos.xy * frustumScale;
+   clipPos.x /= aspect;
+   clipPos.z = cameraPos.z * zFar / (zFar - zNear);
+   clipPos.z -= zNear * zFar / (zFar - zNear);
+   clipPos.w = cameraPos.z;
+
+   gl_Position = clipPos;
+   c_in = color;
+}
+)glsl";
+
+// Points and fan of a circle, around the origin with radius 1, for the instanced circle draws
+template <int N>
+void fill_circle_mesh(float (&corners)[N * 2], unsigned int (&indices)[(N - 2) * 3]) {
+    float angle = 360.0f / N;
+    for (int i = 0; i < N; i++) {
+        corners[i * 2] = cos(angle * i * PI / 180);
+        corners[i * 2 + 1] = sin(angle * i * PI / 180);
+    }
+    for (int i = 0; i < N - 2; i++) {
+        indices[i * 3] = 0;
+        indices[i * 3 + 1] = i + 1;
+        indices[i * 3 + 2] = i + 2;
+    }
+}
+
+// Draws any number of stars with a single call, N is the number of points of the circle
+template <int N>
+class StarRenderer {
+    unsigned int va = 0, mesh_vb = 0, eb = 0, instance_vb = 0;
+    size_t capacity;
+
+public:
+    explicit StarRenderer(size_t max_instances) : capacity{ max_instances } {
+        float corners[N * 2];
+        unsigned int indices[(N - 2) * 3];
+        fill_circle_mesh<N>(corners, indices);
+
+        if (gl_enabled) {
+            glGenVertexArrays(1, &va);
+            glGenBuffers(1, &mesh_vb);
+            glGenBuffers(1, &eb);
+            glGenBuffers(1, &instance_vb);
+        }
+        counted_bind_vertex_array(va);
+        counted_bind_buffer(GL_ARRAY_BUFFER, mesh_vb);
+        counted_buffer_data(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        counted_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, eb);
+        counted_buffer_data(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        if (gl_enabled) {
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+            glEnableVertexAttribArray(0);
+        }
+
+        counted_bind_buffer(GL_ARRAY_BUFFER, instance_vb);
+        counted_buffer_data(GL_ARRAY_BUFFER, capacity * sizeof(StarInstance), nullptr, GL_STREAM_DRAW);
+        if (gl_enabled) {
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), 0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribDivisor(1, 1);
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), (void*)offsetof(StarInstance, r));
+            glEnableVertexAttribArray(2);
+            glVertexAttribDivisor(2, 1);
+        }
+        counted_bind_buffer(GL_ARRAY_BUFFER, 0);
+        counted_bind_vertex_array(0);
+    }
+
+    // Only the first count instances are sent, the rest of the buffer keeps last frame's data
+    void upload(const StarInstance* instances, size_t count) {
+        if (count > capacity)
+            count = capacity;
+        counted_bind_buffer(GL_ARRAY_BUFFER, instance_vb);
+        counted_buffer_sub_data(GL_ARRAY_BUFFER, 0, count * sizeof(StarInstance), instances);
+        counted_bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void draw(size_t count) {
+        if (count == 0)
+            return;
+        counted_bind_vertex_array(va);
+        counted_draw_elements_instanced(GL_TRIANGLES, (N - 2) * 3, GL_UNSIGNED_INT, 0, GLsizei(count));
+        counted_bind_vertex_array(0);
+    }
+};
+
+// One StarRenderer per circle level, each level is one instanced draw
+class CircleLodRenderer {
+    // One member per level, adding a level needs another renderer here
+    static_assert(circle_lod_count == 4, "CircleLodRenderer has a StarRenderer for each of 4 circle levels");
+    StarRenderer<circle_lod_points[0]> lod0;
+    StarRenderer<circle_lod_points[1]> lod1;
+    StarRenderer<circle_lod_points[2]> lod2;
+    StarRenderer<circle_lod_points[3]> lod3;
+
+public:
+    explicit CircleLodRenderer(size_t max_instances) : lod0{ max_instances }, lod1{ max_instances },
+        lod2{ max_instances }, lod3{ max_instances } {
+    }
+
+    // Level l is count[l] instances starting at offset[l]
+    void upload(const StarInstance* instances, const size_t* offset, const size_t* count) {
+        lod0.upload(instances + offset[0], count[0]);
+        lod1.upload(instances + offset[1], count[1]);
+        lod2.upload(instances + offset[2], count[2]);
+        lod3.upload(instances + offset[3], count[3]);
+    }
+
+    void draw(const size_t* count) {
+        lod0.draw(count[0]);
+        lod1.draw(count[1]);
+        lod2.draw(count[2]);
+        lod3.draw(count[3]);
+    }
+};
+
+// Point sprite shaders for stars too small to be worth a circle and for cluster impostors.
+// The sprite is as wide as the star's projected diameter, at least a pixel
+const std::string sprite_vs = R"glsl(
+#version 330 core
+
+layout(location = 0) in vec4 center_radius;
+layout(location = 1) in vec4 color;
+out vec4 c_in;
+
+uniform float zNear;
+uniform float zFar;
+uniform float frustumScale;
+uniform float aspect;
+uniform float viewportHeight;
+uniform mat3 view;
+
+void main()
+{
+   vec4 cameraPos = vec4(view * center_radius.xyz, 1.0);
+   vec4 clipPos;
+
+   clipPos.xy = cameraPos.xy * frustumScale;
+   clipPos.x /= aspect;
+   clipPos.z = cameraPos.z * zFar / (zFar - zNear);
+   clipPos.z -= zNear * zFar / (zFar - zNear);
+   clipPos.w = cameraPos.z;
+
+   gl_Position = clipPos;
+   gl_PointSize = max(1.0, center_radius.w * frustumScale * viewportHeight / cameraPos.z);
+   c_in = color;
+}
+)glsl";
+
+const std::string sprite_fs = R"glsl(
+#version 330 core
+in vec4 c_in;
+out vec4 color;
+
+void main(){
+    float d = length(gl_PointCoord * 2.0 - 1.0);
+    if (d > 1.0)
+        discard;
+    color = vec4(c_in.rgb, c_in.a * (1.0 - smoothstep(0.5, 1.0, d)));
+}
+)glsl";
+
+// Draws point stars and impostors as blended point sprites with a single call, has its own program
+class SpriteRenderer {
+    unsigned int prog = 0, va = 0, vb = 0;
+    int frustum_scale_unif = -1, view_unif = -1;
+    size_t capacity;
+
+public:
+    // Needs the program that should be current afterwards since building the sprite program switches to it
+    SpriteRenderer(size_t max_sprites, unsigned int restore_prog) : capacity{ max_sprites } {
+        if (gl_enabled) {
+            prog = create_and_use_shaders(sprite_vs, sprite_fs);
+            glUniform1f(glGetUniformLocation(prog, "zNear"), Znear);
+            glUniform1f(glGetUniformLocation(prog, "zFar"), Zfar);
+            glUniform1f(glGetUniformLocation(prog, "aspect"), aspect);
+            glUniform1f(glGetUniformLocation(prog, "viewportHeight"), float(HEIGHT));
+            frustum_scale_unif = glGetUniformLocation(prog, "frustumScale");
+            view_unif = glGetUniformLocation(prog, "view");
+            glUseProgram(restore_prog);
+            glGenVertexArrays(1, &va);
+            glGenBuffers(1, &vb);
+        }
+        counted_bind_vertex_array(va);
+        counted_bind_buffer(GL_ARRAY_BUFFER, vb);
+        counted_buffer_data(GL_ARRAY_BUFFER, capacity * sizeof(StarInstance), nullptr, GL_STREAM_DRAW);
+        if (gl_enabled) {
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), 0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(StarInstance), (void*)offsetof(StarInstance, r));
+            glEnableVertexAttribArray(1);
+        }
+        counted_bind_buffer(GL_ARRAY_BUFFER, 0);
+        counted_bind_vertex_array(0);
+    }
+
+    void upload(const StarInstance* sprites, size_t count) {
+        if (count > capacity)
+            count = capacity;
+        counted_bind_buffer(GL_ARRAY_BUFFER, vb);
+        counted_buffer_sub_data(GL_ARRAY_BUFFER, 0, count * sizeof(StarInstance), sprites);
+        counted_bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Same view and field of view as the star program, leaves restore_prog current
+    void draw(size_t count, float yaw, float pitch, float frustum_scale, unsigned int restore_prog) {
+        if (count == 0)
+            return;
+        counted_use_program(prog);
+        if (gl_enabled) {
+            glUniform1f(frustum_scale_unif, frustum_scale);
+            glEnable(GL_PROGRAM_POINT_SIZE);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        set_view_rotation(view_unif, yaw, pitch);
+        counted_bind_vertex_array(va);
+        counted_draw_arrays(GL_POINTS, 0, GLsizei(count));
+        counted_bind_vertex_array(0);
+        if (gl_enabled) {
+            glDisable(GL_BLEND);
+            glDisable(GL_PROGRAM_POINT_SIZE);
+        }
+        counted_use_program(restore_prog);
+    }
+};
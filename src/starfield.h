@@ -0,0 +1,1239 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "frustum.h"
+#include "helper.h"
+#include "perf_counters.h"
+#include "star_renderer.h"
+#include "stats.h"
+
+const int num_stars = 2500;
+const float init_star_size = 0.001;
+Position init_speed = { 0, 0, 0, 1 };
+const float max_speed_z = 5;
+const float max_speed_xy = 5;
+const float min_speed = 0.01;
+const float slow_down_rate = 0.90;
+
+// Stars are grouped into a loose grid of clusters so whole groups can be culled or drawn coarser.
+// The grid covers the box stars are kept in, with about this many stars per cluster
+const int stars_per_cluster = 64;
+// Clusters whose biggest star projects smaller than this many pixels across are drawn as point sprites
+const float point_lod_pixels = 2.f;
+
+// Field of view at a speed, wider the faster we go
+float fov_at(float speed) {
+    return speed / sqrt(2 * (max_speed_xy * max_speed_xy) + max_speed_z * max_speed_z) * 360 + 45;
+}
+
+// Stars further than this from the camera aren't stepped, they're drawn from a baked background layer.
+// The layer is moved as a whole, and only re-sorted and re-baked once the camera moved far enough since the last bake
+const float far_shell_radius = 0.7f * Zfar;
+// Most a far star may be off on screen before the layer is re-baked, in pixels of a view this tall.
+// The height is fixed rather than the window's so replays re-bake at the same steps
+const float far_max_error_pixels = 4.f;
+const float far_error_view_height = 1080.f;
+
+// Furthest a star in the box can be from the camera, at a corner
+const float far_outer_radius = sqrtf(2.5f * 2.5f + 2.5f * 2.5f + 5.f * 5.f);
+// The skybox corrects for the camera's movement since the bake as if every far star were this far away.
+// Halfway between the shell and the corner in 1 / distance, so the stars at either end are off the least
+const float far_parallax_radius = 2 / (1 / far_shell_radius + 1 / far_outer_radius);
+// Share of the camera's movement a far star still ends up off by after that correction, measured at the shell
+const float far_parallax_residual = (1 - far_shell_radius / far_outer_radius) / 2;
+
+// How far a star on the far shell may be off before the far layer is re-baked, it's about
+// distance / far_shell_radius radians off then. The view widens with speed, which spreads fewer pixels
+// over a radian and allows more
+float far_rebake_distance(float speed) {
+    float half_fov = to_rad(std::min(fov_at(speed), 170.f)) / 2;
+    float pixels_per_radian = far_error_view_height / 2 / tanf(half_fov);
+    return far_shell_radius * far_max_error_pixels / pixels_per_radian;
+}
+// Only near stars are clustered, so impostors are the clusters in the outer part of the near shell.
+// Beyond this distance a cluster is drawn as a single impostor sprite
+const float impostor_distance = 0.9f * far_shell_radius;
+
+// Turns about the x, y and z axes, for motion applied to many stars at once
+Position rotated_x(Position p, float deg) {
+    float c = cos(to_rad(deg)), s = sin(to_rad(deg));
+    return Position{ p.x, p.y * c - p.z * s, p.y * s + p.z * c, p.w };
+}
+
+Position rotated_y(Position p, float deg) {
+    float c = cos(to_rad(deg)), s = sin(to_rad(deg));
+    return Position{ p.x * c + p.z * s, p.y, -p.x * s + p.z * c, p.w };
+}
+
+Position rotated_z(Position p, float deg) {
+    float c = cos(to_rad(deg)), s = sin(to_rad(deg));
+    return Position{ p.x * c - p.y * s, p.x * s + p.y * c, p.z, p.w };
+}
+
+// Fastest a star drifts on its own, in units per second along each axis. Set before the Starfield is made
+float max_drift = 0.05f;
+
+// Own velocity of a new star, in the frame its center is stored in
+Position generate_drift() {
+    return Position{ (generate_color() * 2 - 1) * max_drift, (generate_color() * 2 - 1) * max_drift,
+        (generate_color() * 2 - 1) * max_drift, 0 };
+}
+
+// Rotations and movement that haven't been applied to a group of stars yet.
+// Where a star of the group is now is its stored center, carried by its drift for elapsed seconds,
+// turned by axes, the columns, then moved by offset
+struct PendingMotion {
+    Position axes[3];
+    Position offset;
+    float elapsed;
+
+    PendingMotion() {
+        reset();
+    }
+
+    void reset() {
+        axes[0] = Position{ 1, 0, 0, 0 };
+        axes[1] = Position{ 0, 1, 0, 0 };
+        axes[2] = Position{ 0, 0, 1, 0 };
+        offset = Position{ 0, 0, 0, 0 };
+        elapsed = 0;
+    }
+
+    Position apply(Position p) const {
+        Position q;
+        q.x = axes[0].x * p.x + axes[1].x * p.y + axes[2].x * p.z + offset.x;
+        q.y = axes[0].y * p.x + axes[1].y * p.y + axes[2].y * p.z + offset.y;
+        q.z = axes[0].z * p.x + axes[1].z * p.y + axes[2].z * p.z + offset.z;
+        q.w = p.w;
+        return q;
+    }
+
+    // Where a star stored at p that drifts by drift is now
+    Position carry(Position p, Position drift) const {
+        return apply(Position{ p.x + drift.x * elapsed, p.y + drift.y * elapsed, p.z + drift.z * elapsed, p.w });
+    }
+
+    // A direction turned like the stars, the drift of a star once it's stored in the new frame
+    Position turn(Position v) const {
+        return Position{ axes[0].x * v.x + axes[1].x * v.y + axes[2].x * v.z,
+            axes[0].y * v.x + axes[1].y * v.y + axes[2].y * v.z,
+            axes[0].z * v.x + axes[1].z * v.y + axes[2].z * v.z, 0 };
+    }
+
+    void rotate_x(float deg) {
+        for (Position& a : axes)
+            a = rotated_x(a, deg);
+        offset = rotated_x(offset, deg);
+    }
+
+    void rotate_y(float deg) {
+        for (Position& a : axes)
+            a = rotated_y(a, deg);
+        offset = rotated_y(offset, deg);
+    }
+
+    void rotate_z(float deg) {
+        for (Position& a : axes)
+            a = rotated_z(a, deg);
+        offset = rotated_z(offset, deg);
+    }
+
+    void move(Position velocity, float dt) {
+        offset.x += velocity.x * dt;
+        offset.y += velocity.y * dt;
+        offset.z += velocity.z * dt;
+        elapsed += dt;
+    }
+
+    float distance() const {
+        return sqrt(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z);
+    }
+
+    // Turns that were never applied pile up rounding, this keeps the axes a rotation
+    void orthonormalize() {
+        auto normalize = [](Position& a) {
+            float len = sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
+            a.x /= len;
+            a.y /= len;
+            a.z /= len;
+        };
+        auto remove = [](Position& a, const Position& b) {
+            float d = a.x * b.x + a.y * b.y + a.z * b.z;
+            a.x -= d * b.x;
+            a.y -= d * b.y;
+            a.z -= d * b.z;
+        };
+        normalize(axes[0]);
+        remove(axes[1], axes[0]);
+        normalize(axes[1]);
+        remove(axes[2], axes[0]);
+        remove(axes[2], axes[1]);
+        normalize(axes[2]);
+    }
+
+    // Column major mat3 of the turn, for the shaders
+    void write_axes(float m[9]) const {
+        for (int k = 0; k < 3; k++) {
+            m[k * 3] = axes[k].x;
+            m[k * 3 + 1] = axes[k].y;
+            m[k * 3 + 2] = axes[k].z;
+        }
+    }
+
+    // The movement turned back into the frame the stars are stored in, for the shaders
+    void write_stored_offset(float v[3]) const {
+        for (int k = 0; k < 3; k++)
+            v[k] = axes[k].x * offset.x + axes[k].y * offset.y + axes[k].z * offset.z;
+    }
+};
+
+// Size of the box stars are kept in
+const float box_size[3] = { 5.f, 5.f, 10.f };
+
+// Stars that leave the box come back in on the other side instead of respawning at a random place.
+// Set before the Starfield is made
+bool wrap_stars = false;
+
+// Integer hash, the same one the shaders use
+uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Folds every position back into the box without branches. A star that wrapped along an axis is shifted along
+// the other two by a hash of its index and salt, so it doesn't come back on the line it left on.
+// One hash per star, 10 bits of it for each axis
+void wrap_into_box(Position* p, const uint32_t* ids, size_t n, uint32_t salt) {
+    salt = hash32(salt);
+    const float inv[3] = { 1 / box_size[0], 1 / box_size[1], 1 / box_size[2] };
+    size_t i = 0;
+#ifdef FRUSTUM_SSE
+    // Four stars at a time, transposed into x, y, z lanes
+    __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.f);
+    __m128i bits = _mm_set1_epi32(1023);
+    // floor, SSE2 only truncates
+    auto floor_ps = [one](__m128 x) {
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), one));
+    };
+    auto fold = [&](__m128 v, int a) {
+        return _mm_sub_ps(v, _mm_mul_ps(floor_ps(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(inv[a])), half)), _mm_set1_ps(box_size[a])));
+    };
+    auto shift = [&](__m128i h, int a) {
+        __m128i lane = _mm_and_si128(a == 0 ? h : _mm_srli_epi32(h, a == 1 ? 10 : 20), bits);
+        return _mm_mul_ps(_mm_cvtepi32_ps(lane), _mm_set1_ps(box_size[a] / 1024.f));
+    };
+    // A shift is less than a box, so one subtraction brings the shifted axis back in
+    auto shift_in = [&](__m128 v, __m128 mask, __m128 by, int a) {
+        v = _mm_add_ps(v, _mm_and_ps(mask, by));
+        return _mm_sub_ps(v, _mm_and_ps(_mm_cmpge_ps(v, _mm_set1_ps(box_size[a] / 2)), _mm_set1_ps(box_size[a])));
+    };
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(&p[i].x), y = _mm_loadu_ps(&p[i + 1].x);
+        __m128 z = _mm_loadu_ps(&p[i + 2].x), w = _mm_loadu_ps(&p[i + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        __m128 fx = fold(x, 0), fy = fold(y, 1), fz = fold(z, 2);
+        __m128 wx = _mm_cmpneq_ps(fx, x), wy = _mm_cmpneq_ps(fy, y), wz = _mm_cmpneq_ps(fz, z);
+        __m128i h = _mm_setr_epi32(int(hash32(ids[i] ^ salt)), int(hash32(ids[i + 1] ^ salt)),
+            int(hash32(ids[i + 2] ^ salt)), int(hash32(ids[i + 3] ^ salt)));
+        // Axes that didn't wrap while another one did
+        x = shift_in(fx, _mm_andnot_ps(wx, _mm_or_ps(wy, wz)), shift(h, 0), 0);
+        y = shift_in(fy, _mm_andnot_ps(wy, _mm_or_ps(wx, wz)), shift(h, 1), 1);
+        z = shift_in(fz, _mm_andnot_ps(wz, _mm_or_ps(wx, wy)), shift(h, 2), 2);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(&p[i].x, x);
+        _mm_storeu_ps(&p[i + 1].x, y);
+        _mm_storeu_ps(&p[i + 2].x, z);
+        _mm_storeu_ps(&p[i + 3].x, w);
+    }
+#endif
+    for (; i < n; i++) {
+        float* v = &p[i].x;
+        uint32_t h = hash32(ids[i] ^ salt);
+        bool wrapped[3];
+        for (int a = 0; a < 3; a++) {
+            float f = v[a] - std::floor(v[a] * inv[a] + 0.5f) * box_size[a];
+            wrapped[a] = f != v[a];
+            v[a] = f;
+        }
+        for (int a = 0; a < 3; a++) {
+            bool others = wrapped[(a + 1) % 3] || wrapped[(a + 2) % 3];
+            v[a] += (!wrapped[a] && others) * float((h >> (10 * a)) & 1023) * (box_size[a] / 1024.f);
+            v[a] -= (v[a] >= box_size[a] / 2) * box_size[a];
+        }
+    }
+}
+
+#ifdef FRUSTUM_SSE
+// hash32 on four lanes. SSE2 has no 32 bit multiply, the odd and even lanes are multiplied separately
+__m128i hash32_4(__m128i x) {
+    auto mullo = [](__m128i a, uint32_t b) {
+        __m128i vb = _mm_set1_epi32(int(b));
+        __m128i even = _mm_mul_epu32(a, vb);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), vb);
+        return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+    };
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = mullo(x, 0x7feb352du);
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = mullo(x, 0x846ca68bu);
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    return x;
+}
+#endif
+
+#ifdef FRUSTUM_SSE
+// For every movemask of four stars, the lanes that are set in order and how many there are
+const __m128i out_lanes[16] = {
+    _mm_setr_epi32(0, 0, 0, 0), _mm_setr_epi32(0, 0, 0, 0), _mm_setr_epi32(1, 0, 0, 0), _mm_setr_epi32(0, 1, 0, 0),
+    _mm_setr_epi32(2, 0, 0, 0), _mm_setr_epi32(0, 2, 0, 0), _mm_setr_epi32(1, 2, 0, 0), _mm_setr_epi32(0, 1, 2, 0),
+    _mm_setr_epi32(3, 0, 0, 0), _mm_setr_epi32(0, 3, 0, 0), _mm_setr_epi32(1, 3, 0, 0), _mm_setr_epi32(0, 1, 3, 0),
+    _mm_setr_epi32(2, 3, 0, 0), _mm_setr_epi32(0, 2, 3, 0), _mm_setr_epi32(1, 2, 3, 0), _mm_setr_epi32(0, 1, 2, 3)
+};
+const uint8_t out_lane_count[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+#endif
+
+// First stage of the respawn: the slots of p that left the box go into out, which needs n + 4 room.
+// Slots are appended without branches, so the loop costs the same however many stars left.
+// Returns how many there are
+size_t collect_out_of_box(const Position* p, size_t n, uint32_t* out) {
+    size_t count = 0, i = 0;
+#ifdef FRUSTUM_SSE
+    __m128 xy_lo = _mm_set1_ps(-2.5f), xy_hi = _mm_set1_ps(2.5f);
+    __m128 z_lo = _mm_set1_ps(-5.f), z_hi = _mm_set1_ps(5.f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(&p[i].x), y = _mm_loadu_ps(&p[i + 1].x);
+        __m128 z = _mm_loadu_ps(&p[i + 2].x), w = _mm_loadu_ps(&p[i + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        __m128 out_mask = _mm_or_ps(_mm_or_ps(_mm_cmple_ps(x, xy_lo), _mm_cmpge_ps(x, xy_hi)),
+            _mm_or_ps(_mm_cmple_ps(y, xy_lo), _mm_cmpge_ps(y, xy_hi)));
+        out_mask = _mm_or_ps(out_mask, _mm_or_ps(_mm_cmplt_ps(z, z_lo), _mm_cmpgt_ps(z, z_hi)));
+        int mask = _mm_movemask_ps(out_mask);
+        // The lanes that are out packed to the front, all four are stored and count only moves past the real ones
+        _mm_storeu_si128((__m128i*)&out[count], _mm_add_epi32(_mm_set1_epi32(int(i)), out_lanes[mask]));
+        count += out_lane_count[mask];
+    }
+#endif
+    for (; i < n; i++) {
+        out[count] = uint32_t(i);
+        count += p[i].x <= -2.5f || p[i].x >= 2.5f || p[i].y <= -2.5f || p[i].y >= 2.5f || p[i].z < -5.f || p[i].z > 5.f;
+    }
+    return count;
+}
+
+// Second stage: the listed slots get new places, an axis that's out
+// comes back somewhere on the far side of the box. The random values are hashes of the star's index and salt,
+// four stars at a time, so no shared engine is stepped
+void respawn_listed(Position* p, const uint32_t* list, size_t count, const uint32_t* ids, uint32_t salt) {
+    uint32_t salts[3] = { hash32(salt * 3), hash32(salt * 3 + 1), hash32(salt * 3 + 2) };
+    const float far_min[3] = { 1.f, 1.f, 1.f }, far_span[3] = { 1.5f, 1.5f, 4.f };
+    size_t j = 0;
+#ifdef FRUSTUM_SSE
+    const float half[3] = { 2.5f, 2.5f, 5.f };
+    __m128 one = _mm_set1_ps(1.f), scale = _mm_set1_ps(1.f / 16777216.f);
+    // lo and hi keep the edge case of the scalar check, x and y are out on the edge, z only past it
+    auto respawn = [&](__m128 v, __m128i id, int a) {
+        __m128 lo = a < 2 ? _mm_cmple_ps(v, _mm_set1_ps(-half[a])) : _mm_cmplt_ps(v, _mm_set1_ps(-half[a]));
+        __m128 hi = a < 2 ? _mm_cmpge_ps(v, _mm_set1_ps(half[a])) : _mm_cmpgt_ps(v, _mm_set1_ps(half[a]));
+        __m128i h = _mm_srli_epi32(hash32_4(_mm_xor_si128(id, _mm_set1_epi32(int(salts[a])))), 8);
+        __m128 far = _mm_add_ps(_mm_set1_ps(far_min[a]), _mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(h), scale), _mm_set1_ps(far_span[a])));
+        // far on the side it came back in from, the axis keeps its value when it didn't leave
+        __m128 sign = _mm_or_ps(_mm_and_ps(lo, one), _mm_andnot_ps(lo, _mm_set1_ps(-1.f)));
+        __m128 out = _mm_or_ps(lo, hi);
+        return _mm_or_ps(_mm_and_ps(out, _mm_mul_ps(sign, far)), _mm_andnot_ps(out, v));
+    };
+    for (; j + 4 <= count; j += 4) {
+        Position* a = &p[list[j]];
+        Position* b = &p[list[j + 1]];
+        Position* c = &p[list[j + 2]];
+        Position* d = &p[list[j + 3]];
+        __m128 x = _mm_loadu_ps(&a->x), y = _mm_loadu_ps(&b->x), z = _mm_loadu_ps(&c->x), w = _mm_loadu_ps(&d->x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        __m128i id = _mm_setr_epi32(int(ids[list[j]]), int(ids[list[j + 1]]), int(ids[list[j + 2]]), int(ids[list[j + 3]]));
+        x = respawn(x, id, 0);
+        y = respawn(y, id, 1);
+        z = respawn(z, id, 2);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(&a->x, x);
+        _mm_storeu_ps(&b->x, y);
+        _mm_storeu_ps(&c->x, z);
+        _mm_storeu_ps(&d->x, w);
+    }
+#endif
+    for (; j < count; j++) {
+        float* v = &p[list[j]].x;
+        uint32_t id = ids[list[j]];
+        for (int a = 0; a < 3; a++) {
+            bool lo = a < 2 ? v[a] <= -2.5f : v[a] < -5.f;
+            bool hi = a < 2 ? v[a] >= 2.5f : v[a] > 5.f;
+            float far = far_min[a] + float(hash32(id ^ salts[a]) >> 8) * (1.f / 16777216.f) * far_span[a];
+            if (lo || hi)
+                v[a] = lo ? far : -far;
+        }
+    }
+}
+
+// Closed form mode: the stars never move on the CPU. A star is where it started plus the field's displacement
+// in world space, wrapped into the box around the camera, and the whole field is turned by turn.
+// The box stays lined up with the world instead of the view, and wrapping stands in for the bound check
+struct ClosedFormState {
+    PendingMotion turn;
+    // Whole boxes moved and what's left, inside half a box
+    int32_t cells[3] = { 0, 0, 0 };
+    float displacement[3] = { 0, 0, 0 };
+    // World space movement of the last step, for interpolating
+    float last_move[3] = { 0, 0, 0 };
+
+    void move(Position velocity, float dt) {
+        // The turn takes world to view, its transpose takes the view space velocity back to world
+        const Position* a = turn.axes;
+        float world[3] = {
+            (a[0].x * velocity.x + a[0].y * velocity.y + a[0].z * velocity.z) * dt,
+            (a[1].x * velocity.x + a[1].y * velocity.y + a[1].z * velocity.z) * dt,
+            (a[2].x * velocity.x + a[2].y * velocity.y + a[2].z * velocity.z) * dt
+        };
+        for (int k = 0; k < 3; k++) {
+            last_move[k] = world[k];
+            displacement[k] += world[k];
+            float whole = std::floor(displacement[k] / box_size[k] + 0.5f);
+            displacement[k] -= whole * box_size[k];
+            cells[k] += int32_t(whole);
+        }
+        turn.orthonormalize();
+    }
+
+    // alpha of the way from the step before to this one, the turn isn't interpolated
+    ClosedFormState at(float alpha) const {
+        ClosedFormState s = *this;
+        for (int k = 0; k < 3; k++)
+            s.displacement[k] -= (1 - alpha) * last_move[k];
+        return s;
+    }
+};
+
+// Distance bands of the near stars. Stars closer to the camera than max_distance are updated every period steps,
+// in between they're drawn where the field's motion puts them, without bound checks.
+// A band's stars are spread over period groups so every step updates about as many stars.
+// Stars past the last band that aren't in the far layer yet go in the last band
+struct UpdateBand {
+    float max_distance;
+    int period;
+};
+
+std::vector<UpdateBand> update_bands = { { 1.5f, 1 }, { 2.5f, 2 }, { far_shell_radius, 4 } };
+
+// Bounds and summary of one grid cell, for the frame being built
+struct StarCluster {
+    // Snapshot slots of the stars in the cell
+    uint32_t begin = 0, end = 0;
+    // Box around the previous and current centers, so it holds for any interpolation, padded by max_radius
+    float lo[3], hi[3];
+    float max_radius = 0;
+    // Mean position before and after the step and mean color, for the impostor
+    Position prev_centroid, centroid;
+    float r = 0, g = 0, b = 0;
+};
+
+// Everything the renderer needs from one simulation step, copied out so another thread can keep stepping.
+// Stars are stored cluster by cluster, order maps a slot back to the star
+struct StarSnapshot {
+    std::vector<Position> prev, curr;
+    std::vector<float> radius;
+    std::vector<uint32_t> order;
+    std::vector<StarCluster> clusters;
+    Position velocity{ 0, 0, 0, 1 };
+    // Far stars as they were at the last bake, bumped version means bake again.
+    // far_axes turns them from then to now, column major, far_offset is how far they moved since in the baked frame
+    std::shared_ptr<const std::vector<StarInstance>> far_layer;
+    uint64_t far_version = 0;
+    float far_axes[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    float far_offset[3] = {};
+    // Stars the step updated, the rest were moved along without a bound check
+    uint32_t updated_stars = 0;
+    // Set in closed form mode, the star arrays are left empty then
+    bool closed_form = false;
+    ClosedFormState closed;
+    uint64_t step = 0;
+    // Cursor motion the stars have been turned by, summed over the whole run
+    double look_x = 0, look_y = 0;
+    // When the step finished, steady clock seconds
+    double time = 0;
+
+    float speed() const {
+        return sqrt(velocity.x * velocity.x + velocity.y * velocity.y + velocity.z * velocity.z);
+    }
+};
+
+// How a cluster is drawn in a frame
+enum ClusterLod : uint8_t {
+    LOD_CULLED,
+    LOD_CIRCLES,
+    LOD_POINTS,
+    LOD_IMPOSTOR
+};
+
+// CPU side of one frame, filled by the cull and build jobs while the previous frame is submitted
+struct FrameBuild {
+    // Interpolated center of every snapshot slot, and 0 when it was culled or else 1 + the circle level it's drawn with
+    std::vector<Position> at;
+    std::vector<uint8_t> in_view;
+    std::vector<uint8_t> cluster_lod;
+    // Interpolated centroid of the clusters drawn as impostors
+    std::vector<Position> cluster_at;
+    // What each cull chunk found, the build chunks get their offsets from these
+    struct ChunkCounts {
+        uint32_t circles[circle_lod_count];
+        uint32_t points, impostors;
+    };
+    std::vector<ChunkCounts> chunk_counts;
+    // Packed to the front: circles level by level, one instanced draw each,
+    // then point stars followed by impostors for the sprite draw
+    std::vector<StarInstance> instances;
+    std::vector<StarInstance> sprites;
+    size_t circle_offset[circle_lod_count] = {}, circle_count[circle_lod_count] = {};
+    size_t visible_count = 0, point_count = 0, impostor_count = 0;
+    // From the snapshot the frame was built from
+    Position velocity{ 0, 0, 0, 1 };
+    std::shared_ptr<const std::vector<StarInstance>> far_layer;
+    uint64_t far_version = 0;
+    float far_axes[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    float far_offset[3] = {};
+    bool closed_form = false;
+    ClosedFormState closed;
+    double look_x = 0, look_y = 0;
+    // How far between the last two steps the frame was built
+    float alpha = 1;
+
+    float speed() const {
+        return sqrt(velocity.x * velocity.x + velocity.y * velocity.y + velocity.z * velocity.z);
+    }
+};
+
+// Generates the stars and holds main way to make movement
+class Starfield {
+
+    // A star is plain data, the instanced renderers draw it
+    struct Star {
+        Position center;
+        float radius;
+        float r, g, b;
+    };
+
+    // Near stars of one update band that are updated on the same steps, [begin, end) of near_stars
+    struct UpdateGroup {
+        uint32_t begin, end;
+        PendingMotion motion;
+        int period, phase;
+    };
+
+    // Stored center and drift of every near star in near_stars order, one array per component
+    struct NearArrays {
+        std::vector<float> x, y, z, dx, dy, dz;
+
+        void resize(size_t n) {
+            for (std::vector<float>* a : { &x, &y, &z, &dx, &dy, &dz })
+                a->resize(n);
+        }
+    };
+
+    std::vector<Star> stars;
+    // Indices of the simulated stars, group after group, and of the ones in the far layer
+    std::vector<uint32_t> near_stars, far_stars;
+    std::vector<UpdateGroup> groups;
+    NearArrays near;
+    // Drift of every star in the frame its center is stored in, the near copies are written back on a re-bake
+    std::vector<float> drift_x, drift_y, drift_z;
+    PendingMotion far_motion;
+    std::shared_ptr<const std::vector<StarInstance>> far_layer;
+    bool closed_form = false;
+    ClosedFormState closed;
+    uint64_t far_version = 0;
+    Position field_velocity;
+    uint64_t steps = 0;
+    // Length of the last step and how many stars it updated
+    float last_dt = 0;
+    uint32_t updated_stars = 0;
+    // Cluster grid size, picked from the star count, and the cell of each star while sorting
+    int grid_x = 1, grid_y = 1, grid_z = 1;
+    std::vector<int> cell_scratch;
+    // Where each near star is now and its drift turned into the view, in near_stars order
+    std::vector<Position> now_scratch, drift_scratch;
+    // Group being updated
+    std::vector<Position> update_scratch, update_drift_scratch;
+    // Slots that left the box, for the batched respawn
+    std::vector<uint32_t> respawn_scratch;
+    // Drawn from the engine once the stars are placed, so respawns and wraps differ between seeds
+    uint32_t respawn_seed = 0;
+    bool slowing_down = false;
+
+    // Lets the benchmarks reach the individual stars
+    friend struct StarfieldAccess;
+public:
+    Starfield(int num_stars, Position vel) : field_velocity{ vel } {
+
+        for (size_t i = 0; i < num_stars; i++)
+        {
+            // Generate random position in x, y, z
+            Position ran_pos{ generate_xy(),
+            generate_xy(),
+            generate_z(),
+            1 };
+
+            // Make new star with pastel colors
+            float r = 0.8f + generate_color() / 5, g = 0.8f + generate_color() / 5, b = 0.8f + generate_color() / 5;
+            stars.push_back(Star{ ran_pos, init_star_size, r, g, b });
+        }
+        for (size_t i = 0; i < stars.size(); i++) {
+            Position drift = generate_drift();
+            drift_x.push_back(drift.x);
+            drift_y.push_back(drift.y);
+            drift_z.push_back(drift.z);
+        }
+        respawn_seed = uint32_t(eng());
+
+        // Cells half as wide as they are deep, the box is twice as deep as it is wide
+        int g = std::max(1, int(std::lround(std::cbrt(num_stars / (2.0 * stars_per_cluster)))));
+        grid_x = grid_y = g;
+        grid_z = 2 * g;
+
+        rebake_far();
+    }
+
+    // Where near stars [begin, end) are after motion, each carried by its own drift, into out.
+    // Their drift turned into the new frame goes into drift_out
+    void integrate_near(const PendingMotion& motion, size_t begin, size_t end, Position* out, Position* drift_out) {
+        const Position* a = motion.axes;
+        float t = motion.elapsed;
+        size_t i = begin;
+#ifdef FRUSTUM_SSE
+        // Four stars at a time straight from the arrays, transposed back into Positions on the way out.
+        // Same order of operations as carry and turn so the tail gives bit identical results
+        __m128 vt = _mm_set1_ps(t);
+        __m128 a0x = _mm_set1_ps(a[0].x), a0y = _mm_set1_ps(a[0].y), a0z = _mm_set1_ps(a[0].z);
+        __m128 a1x = _mm_set1_ps(a[1].x), a1y = _mm_set1_ps(a[1].y), a1z = _mm_set1_ps(a[1].z);
+        __m128 a2x = _mm_set1_ps(a[2].x), a2y = _mm_set1_ps(a[2].y), a2z = _mm_set1_ps(a[2].z);
+        __m128 ox = _mm_set1_ps(motion.offset.x), oy = _mm_set1_ps(motion.offset.y), oz = _mm_set1_ps(motion.offset.z);
+        __m128 one = _mm_set1_ps(1), zero = _mm_setzero_ps();
+        for (; i + 4 <= end; i += 4) {
+            __m128 dx = _mm_loadu_ps(&near.dx[i]), dy = _mm_loadu_ps(&near.dy[i]), dz = _mm_loadu_ps(&near.dz[i]);
+            __m128 px = _mm_add_ps(_mm_loadu_ps(&near.x[i]), _mm_mul_ps(dx, vt));
+            __m128 py = _mm_add_ps(_mm_loadu_ps(&near.y[i]), _mm_mul_ps(dy, vt));
+            __m128 pz = _mm_add_ps(_mm_loadu_ps(&near.z[i]), _mm_mul_ps(dz, vt));
+            __m128 qx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a0x, px), _mm_mul_ps(a1x, py)), _mm_mul_ps(a2x, pz)), ox);
+            __m128 qy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a0y, px), _mm_mul_ps(a1y, py)), _mm_mul_ps(a2y, pz)), oy);
+            __m128 qz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a0z, px), _mm_mul_ps(a1z, py)), _mm_mul_ps(a2z, pz)), oz);
+            __m128 qw = one;
+            _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+            _mm_storeu_ps(&out[i - begin].x, qx);
+            _mm_storeu_ps(&out[i - begin + 1].x, qy);
+            _mm_storeu_ps(&out[i - begin + 2].x, qz);
+            _mm_storeu_ps(&out[i - begin + 3].x, qw);
+
+            __m128 ux = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0x, dx), _mm_mul_ps(a1x, dy)), _mm_mul_ps(a2x, dz));
+            __m128 uy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0y, dx), _mm_mul_ps(a1y, dy)), _mm_mul_ps(a2y, dz));
+            __m128 uz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0z, dx), _mm_mul_ps(a1z, dy)), _mm_mul_ps(a2z, dz));
+            __m128 uw = zero;
+            _MM_TRANSPOSE4_PS(ux, uy, uz, uw);
+            _mm_storeu_ps(&drift_out[i - begin].x, ux);
+            _mm_storeu_ps(&drift_out[i - begin + 1].x, uy);
+            _mm_storeu_ps(&drift_out[i - begin + 2].x, uz);
+            _mm_storeu_ps(&drift_out[i - begin + 3].x, uw);
+        }
+#endif
+        for (; i < end; i++) {
+            Position drift{ near.dx[i], near.dy[i], near.dz[i], 0 };
+            out[i - begin] = motion.carry(Position{ near.x[i], near.y[i], near.z[i], 1 }, drift);
+            drift_out[i - begin] = motion.turn(drift);
+        }
+    }
+
+    // Wraps or respawns the stars of p that left the box, ids are their star indices.
+    // Respawns are batched: the ones that left are collected first, then all get their new places at once
+    void keep_in_box(Position* p, const uint32_t* ids, size_t n) {
+        uint32_t salt = uint32_t(steps) ^ respawn_seed;
+        if (wrap_stars) {
+            wrap_into_box(p, ids, n, salt);
+            return;
+        }
+        respawn_scratch.resize(n + 4);
+        size_t count = collect_out_of_box(p, n, respawn_scratch.data());
+        respawn_listed(p, respawn_scratch.data(), count, ids, salt);
+    }
+
+    // Applies a group's pending motion to its stars, then respawns or wraps the ones that left the box
+    void update_group(UpdateGroup& group) {
+        size_t n = group.end - group.begin;
+        update_scratch.resize(n);
+        update_drift_scratch.resize(n);
+        integrate_near(group.motion, group.begin, group.end, update_scratch.data(), update_drift_scratch.data());
+        group.motion.reset();
+        PerfScope bound_scope(REGION_BOUND_CHECK, n);
+        keep_in_box(update_scratch.data(), &near_stars[group.begin], n);
+        for (size_t k = 0; k < n; k++) {
+            size_t i = group.begin + k;
+            stars[near_stars[i]].center = update_scratch[k];
+            Position p = update_scratch[k];
+            near.x[i] = p.x;
+            near.y[i] = p.y;
+            near.z[i] = p.z;
+            near.dx[i] = update_drift_scratch[k].x;
+            near.dy[i] = update_drift_scratch[k].y;
+            near.dz[i] = update_drift_scratch[k].z;
+        }
+        updated_stars += uint32_t(n);
+    }
+
+    Position drift_of(uint32_t i) const {
+        return Position{ drift_x[i], drift_y[i], drift_z[i], 0 };
+    }
+
+    // Brings every star up to date, respawns the ones that left the box, sorts them into update bands
+    // and the far layer again and packs the far ones for the next bake
+    void rebake_far() {
+        for (UpdateGroup& group : groups)
+            update_group(group);
+        for (size_t k = 0; k < near_stars.size(); k++) {
+            drift_x[near_stars[k]] = near.dx[k];
+            drift_y[near_stars[k]] = near.dy[k];
+            drift_z[near_stars[k]] = near.dz[k];
+        }
+        update_scratch.resize(far_stars.size());
+        for (size_t k = 0; k < far_stars.size(); k++)
+            update_scratch[k] = far_motion.carry(stars[far_stars[k]].center, drift_of(far_stars[k]));
+        keep_in_box(update_scratch.data(), far_stars.data(), far_stars.size());
+        for (size_t k = 0; k < far_stars.size(); k++) {
+            uint32_t i = far_stars[k];
+            stars[i].center = update_scratch[k];
+            Position drift = far_motion.turn(drift_of(i));
+            drift_x[i] = drift.x;
+            drift_y[i] = drift.y;
+            drift_z[i] = drift.z;
+        }
+        far_motion.reset();
+
+        // One group per step of each band's period
+        groups.clear();
+        std::vector<size_t> first_group;
+        for (const UpdateBand& band : update_bands) {
+            first_group.push_back(groups.size());
+            for (int phase = 0; phase < band.period; phase++)
+                groups.push_back(UpdateGroup{ 0, 0, PendingMotion{}, band.period, phase });
+        }
+        std::vector<std::vector<uint32_t>> members(groups.size());
+        std::vector<size_t> band_count(update_bands.size(), 0);
+
+        far_stars.clear();
+        std::shared_ptr<std::vector<StarInstance>> layer = std::make_shared<std::vector<StarInstance>>();
+        for (uint32_t i = 0; i < stars.size(); i++) {
+            Position p = stars[i].center;
+            float distance = sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            if (distance <= far_shell_radius) {
+                size_t band = 0;
+                while (band + 1 < update_bands.size() && distance > update_bands[band].max_distance)
+                    band++;
+                size_t count = band_count[band]++;
+                members[first_group[band] + count % update_bands[band].period].push_back(i);
+                continue;
+            }
+            far_stars.push_back(i);
+            StarInstance inst;
+            inst.x = p.x;
+            inst.y = p.y;
+            inst.z = p.z;
+            inst.radius = stars[i].radius;
+            inst.r = stars[i].r;
+            inst.g = stars[i].g;
+            inst.b = stars[i].b;
+            inst.a = 1;
+            layer->push_back(inst);
+        }
+        far_layer = layer;
+        far_version++;
+
+        near_stars.clear();
+        for (size_t g = 0; g < groups.size(); g++) {
+            groups[g].begin = uint32_t(near_stars.size());
+            near_stars.insert(near_stars.end(), members[g].begin(), members[g].end());
+            groups[g].end = uint32_t(near_stars.size());
+        }
+        near.resize(near_stars.size());
+        for (size_t k = 0; k < near_stars.size(); k++) {
+            uint32_t i = near_stars[k];
+            Position p = stars[i].center;
+            near.x[k] = p.x;
+            near.y[k] = p.y;
+            near.z[k] = p.z;
+            near.dx[k] = drift_x[i];
+            near.dy[k] = drift_y[i];
+            near.dz[k] = drift_z[i];
+        }
+    }
+
+    // Where every near star is now into now_scratch and its drift in the view into drift_scratch, in near_stars order
+    void gather_near_positions() {
+        now_scratch.resize(near_stars.size());
+        drift_scratch.resize(near_stars.size());
+        for (const UpdateGroup& group : groups)
+            integrate_near(group.motion, group.begin, group.end, &now_scratch[group.begin], &drift_scratch[group.begin]);
+    }
+
+    // Advances the simulation by one fixed step, nothing is uploaded.
+    // Rotations have to happen before this, the interpolation doesn't rotate the previous centers
+    void step(float dt) {
+        if (slowing_down && get_speed() >= min_speed) {
+            field_velocity.x *= slow_down_rate;
+            field_velocity.y *= slow_down_rate;
+            field_velocity.z *= slow_down_rate;
+        }
+        else if (slowing_down && get_speed() < min_speed) {
+            field_velocity.x = 0;
+            field_velocity.y = 0;
+            field_velocity.z = 0;
+            slowing_down = false;
+        }
+        if (closed_form) {
+            closed.move(field_velocity, dt);
+            steps++;
+            return;
+        }
+        PerfScope tick_scope(REGION_TICK, near_stars.size());
+        updated_stars = 0;
+        last_dt = dt;
+        for (UpdateGroup& group : groups)
+            group.motion.move(field_velocity, dt);
+        far_motion.move(field_velocity, dt);
+        // The far stars drift on their own too, so at rest the layer still goes stale. No star is
+        // further from its baked place than the fastest drift, max_drift along every axis, times the layer's age
+        float drifted = max_drift * sqrtf(3.f) * far_motion.elapsed;
+        if (far_motion.distance() * far_parallax_residual + drifted > far_rebake_distance(get_speed())) {
+            rebake_far();
+        }
+        else {
+            // Bound checks happen after the move, a respawned star shows up at its new place straight away
+            for (UpdateGroup& group : groups) {
+                if (steps % group.period == uint64_t(group.phase))
+                    update_group(group);
+            }
+        }
+        steps++;
+    }
+
+    // Cell of the loose grid a center falls in, centers slightly outside the box go to the edge cells
+    int cell_of(Position p) {
+        int cx = std::min(std::max(int((p.x + 2.5f) / 5.f * grid_x), 0), grid_x - 1);
+        int cy = std::min(std::max(int((p.y + 2.5f) / 5.f * grid_y), 0), grid_y - 1);
+        int cz = std::min(std::max(int((p.z + 5.f) / 10.f * grid_z), 0), grid_z - 1);
+        return (cz * grid_y + cy) * grid_x + cx;
+    }
+
+    // Copies what the renderer needs out of the last step, the stars stay untouched.
+    // The clusters are sorted again from scratch every step, so moves, rotations and respawns never leave them stale.
+    // Every star moved by the last step's velocity plus its own drift, so that's where the previous center is
+    void write_snapshot(StarSnapshot& snap) {
+        if (!closed_form)
+            gather_near_positions();
+        size_t n = closed_form ? 0 : near_stars.size();
+        int cells = grid_x * grid_y * grid_z;
+        snap.prev.resize(n);
+        snap.curr.resize(n);
+        snap.radius.resize(n);
+        snap.order.resize(n);
+        snap.clusters.assign(cells, StarCluster{});
+        cell_scratch.resize(n);
+
+        // Counting sort by cell
+        for (size_t i = 0; i < n; i++) {
+            cell_scratch[i] = cell_of(now_scratch[i]);
+            snap.clusters[cell_scratch[i]].end++;
+        }
+        uint32_t offset = 0;
+        for (StarCluster& c : snap.clusters) {
+            uint32_t count = c.end;
+            c.begin = c.end = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < n; i++) {
+            StarCluster& c = snap.clusters[cell_scratch[i]];
+            uint32_t slot = c.end++;
+            const Star& star = stars[near_stars[i]];
+            Position curr = now_scratch[i];
+            Position v = drift_scratch[i];
+            Position prev{ curr.x - (field_velocity.x + v.x) * last_dt, curr.y - (field_velocity.y + v.y) * last_dt,
+                curr.z - (field_velocity.z + v.z) * last_dt, curr.w };
+            float radius = star.radius;
+            snap.prev[slot] = prev;
+            snap.curr[slot] = curr;
+            snap.radius[slot] = radius;
+            snap.order[slot] = near_stars[i];
+
+            float r = star.r, g = star.g, b = star.b;
+            if (c.end - c.begin == 1) {
+                c.lo[0] = c.hi[0] = curr.x;
+                c.lo[1] = c.hi[1] = curr.y;
+                c.lo[2] = c.hi[2] = curr.z;
+                c.prev_centroid = c.centroid = Position{ 0, 0, 0, 1 };
+            }
+            c.lo[0] = std::min({ c.lo[0], prev.x, curr.x });
+            c.lo[1] = std::min({ c.lo[1], prev.y, curr.y });
+            c.lo[2] = std::min({ c.lo[2], prev.z, curr.z });
+            c.hi[0] = std::max({ c.hi[0], prev.x, curr.x });
+            c.hi[1] = std::max({ c.hi[1], prev.y, curr.y });
+            c.hi[2] = std::max({ c.hi[2], prev.z, curr.z });
+            c.max_radius = std::max(c.max_radius, radius);
+            c.prev_centroid.x += prev.x;
+            c.prev_centroid.y += prev.y;
+            c.prev_centroid.z += prev.z;
+            c.centroid.x += curr.x;
+            c.centroid.y += curr.y;
+            c.centroid.z += curr.z;
+            c.r += r;
+            c.g += g;
+            c.b += b;
+        }
+        for (StarCluster& c : snap.clusters) {
+            float count = float(c.end - c.begin);
+            if (count == 0)
+                continue;
+            for (int k = 0; k < 3; k++) {
+                c.lo[k] -= c.max_radius;
+                c.hi[k] += c.max_radius;
+            }
+            c.prev_centroid.x /= count;
+            c.prev_centroid.y /= count;
+            c.prev_centroid.z /= count;
+            c.centroid.x /= count;
+            c.centroid.y /= count;
+            c.centroid.z /= count;
+            c.r /= count;
+            c.g /= count;
+            c.b /= count;
+        }
+        snap.velocity = field_velocity;
+        snap.far_layer = far_layer;
+        snap.far_version = far_version;
+        far_motion.write_axes(snap.far_axes);
+        far_motion.write_stored_offset(snap.far_offset);
+        snap.updated_stars = updated_stars;
+        snap.closed_form = closed_form;
+        snap.closed = closed;
+    }
+
+    // Clusters in chunk of chunks, the same split for the cull and the build
+    void chunk_range(size_t clusters, int chunk, int chunks, size_t& begin, size_t& end) {
+        begin = clusters * chunk / chunks;
+        end = clusters * (chunk + 1) / chunks;
+    }
+
+    // Interpolates the slots in [begin, end) and flags the ones inside the frustum, or all of them when test is false.
+    // Returns how many passed
+    uint32_t cull_range(const StarSnapshot& snap, float alpha, const Frustum& frustum, FrameBuild& out,
+        size_t begin, size_t end, bool test) {
+        uint32_t count = 0;
+        size_t i = begin;
+#ifdef FRUSTUM_SSE
+        // Four stars at a time, Position is four floats so a transpose gives x, y, z lanes
+        __m128 va = _mm_set1_ps(alpha);
+        for (; i + 4 <= end; i += 4) {
+            __m128 x = _mm_loadu_ps(&snap.curr[i].x), y = _mm_loadu_ps(&snap.curr[i + 1].x);
+            __m128 z = _mm_loadu_ps(&snap.curr[i + 2].x), w = _mm_loadu_ps(&snap.curr[i + 3].x);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            if (alpha < 1) {
+                __m128 px = _mm_loadu_ps(&snap.prev[i].x), py = _mm_loadu_ps(&snap.prev[i + 1].x);
+                __m128 pz = _mm_loadu_ps(&snap.prev[i + 2].x), pw = _mm_loadu_ps(&snap.prev[i + 3].x);
+                _MM_TRANSPOSE4_PS(px, py, pz, pw);
+                x = _mm_add_ps(px, _mm_mul_ps(_mm_sub_ps(x, px), va));
+                y = _mm_add_ps(py, _mm_mul_ps(_mm_sub_ps(y, py), va));
+                z = _mm_add_ps(pz, _mm_mul_ps(_mm_sub_ps(z, pz), va));
+            }
+            int mask = test ? frustum.contains4(x, y, z, _mm_loadu_ps(&snap.radius[i])) : 0xF;
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            _mm_storeu_ps(&out.at[i].x, x);
+            _mm_storeu_ps(&out.at[i + 1].x, y);
+            _mm_storeu_ps(&out.at[i + 2].x, z);
+            _mm_storeu_ps(&out.at[i + 3].x, w);
+            for (int k = 0; k < 4; k++) {
+                out.in_view[i + k] = (mask >> k) & 1;
+                count += (mask >> k) & 1;
+            }
+        }
+#endif
+        for (; i < end; i++) {
+            Position a = snap.prev[i], p = snap.curr[i];
+            if (alpha < 1) {
+                p.x = a.x + (p.x - a.x) * alpha;
+                p.y = a.y + (p.y - a.y) * alpha;
+                p.z = a.z + (p.z - a.z) * alpha;
+            }
+            out.at[i] = p;
+            out.in_view[i] = !test || frustum.contains(p, snap.radius[i]);
+            count += out.in_view[i];
+        }
+        return count;
+    }
+
+    // Cull job for one chunk of clusters. Clusters outside the frustum are skipped whole and clusters inside it
+    // take all their stars untested, only the ones on the edge test star by star. Each cluster then gets a level of detail.
+    // Only reads the snapshot so it runs on any thread
+    void cull_chunk(const StarSnapshot& snap, float alpha, const Frustum& frustum, FrameBuild& out, int chunk, int chunks) {
+        size_t begin, end;
+        chunk_range(snap.clusters.size(), chunk, chunks, begin, end);
+        FrameBuild::ChunkCounts counts{};
+        // Pixels per unit at distance 1
+        float pixels_per_unit = frustum.scale * HEIGHT / 2;
+        for (size_t k = begin; k < end; k++) {
+            const StarCluster& c = snap.clusters[k];
+            out.cluster_lod[k] = LOD_CULLED;
+            if (c.begin == c.end)
+                continue;
+            Frustum::Overlap overlap = frustum.classify_box(c.lo, c.hi);
+            if (overlap == Frustum::OUTSIDE)
+                continue;
+            float nearest = std::max(c.lo[2], Znear);
+            if (nearest > impostor_distance) {
+                const Position& a = c.prev_centroid;
+                const Position& b = c.centroid;
+                out.cluster_at[k] = Position{ a.x + (b.x - a.x) * alpha, a.y + (b.y - a.y) * alpha, a.z + (b.z - a.z) * alpha, 1 };
+                out.cluster_lod[k] = LOD_IMPOSTOR;
+                counts.impostors++;
+                continue;
+            }
+            uint32_t passed = cull_range(snap, alpha, frustum, out, c.begin, c.end, overlap == Frustum::INTERSECTS);
+            if (passed == 0)
+                continue;
+            if (2 * c.max_radius * pixels_per_unit / nearest < point_lod_pixels) {
+                out.cluster_lod[k] = LOD_POINTS;
+                counts.points += passed;
+            }
+            else {
+                // Circles get as many points as their size on screen needs
+                out.cluster_lod[k] = LOD_CIRCLES;
+                for (uint32_t i = c.begin; i < c.end; i++) {
+                    if (!out.in_view[i])
+                        continue;
+                    int level = circle_lod_for(snap.radius[i] * pixels_per_unit / std::max(out.at[i].z, Znear));
+                    out.in_view[i] = uint8_t(1 + level);
+                    counts.circles[level]++;
+                }
+            }
+        }
+        out.chunk_counts[chunk] = counts;
+    }
+
+    // Sizes a FrameBuild for this field, once before the first cull
+    void prepare_build(FrameBuild& out, int chunks) {
+        size_t clusters = get_cluster_count();
+        out.at.resize(stars.size());
+        out.in_view.assign(stars.size(), 0);
+        out.cluster_lod.assign(clusters, LOD_CULLED);
+        out.cluster_at.resize(clusters);
+        out.chunk_counts.assign(chunks, FrameBuild::ChunkCounts{});
+        out.instances.resize(stars.size());
+        out.sprites.resize(stars.size() + clusters);
+        out.visible_count = out.point_count = out.impostor_count = 0;
+    }
+
+    // Build job: packs one chunk's stars and impostors into the instance arrays, after every chunk is culled.
+    // Chunks write disjoint ranges so they run in parallel
+    void build_chunk(const StarSnapshot& snap, FrameBuild& out, int chunk, int chunks) {
+        // Where each circle level starts and where this chunk's part of it starts
+        size_t level_start[circle_lod_count] = {}, circles[circle_lod_count] = {};
+        size_t points = 0, impostors = 0, total_points = 0;
+        for (int c = 0; c < chunks; c++) {
+            for (int l = 0; l < circle_lod_count; l++) {
+                for (int above = l + 1; above < circle_lod_count; above++)
+                    level_start[above] += out.chunk_counts[c].circles[l];
+                if (c < chunk)
+                    circles[l] += out.chunk_counts[c].circles[l];
+            }
+            if (c < chunk) {
+                points += out.chunk_counts[c].points;
+                impostors += out.chunk_counts[c].impostors;
+            }
+            total_points += out.chunk_counts[c].points;
+        }
+        for (int l = 0; l < circle_lod_count; l++)
+            circles[l] += level_start[l];
+        // Impostors go after every point star
+        impostors += total_points;
+
+        size_t begin, end;
+        chunk_range(snap.clusters.size(), chunk, chunks, begin, end);
+        for (size_t k = begin; k < end; k++) {
+            const StarCluster& c = snap.clusters[k];
+            uint8_t lod = out.cluster_lod[k];
+            if (lod == LOD_IMPOSTOR) {
+                // One sprite as bright as a star, grown with the number of stars it stands for
+                StarInstance& inst = out.sprites[impostors++];
+                inst.x = out.cluster_at[k].x;
+                inst.y = out.cluster_at[k].y;
+                inst.z = out.cluster_at[k].z;
+                inst.radius = c.max_radius * std::sqrt(float(c.end - c.begin));
+                inst.r = c.r;
+                inst.g = c.g;
+                inst.b = c.b;
+                inst.a = 1;
+                continue;
+            }
+            if (lod == LOD_CULLED)
+                continue;
+            for (uint32_t i = c.begin; i < c.end; i++) {
+                if (!out.in_view[i])
+                    continue;
+                StarInstance& inst = lod == LOD_CIRCLES ? out.instances[circles[out.in_view[i] - 1]++] : out.sprites[points++];
+                inst.x = out.at[i].x;
+                inst.y = out.at[i].y;
+                inst.z = out.at[i].z;
+                inst.radius = snap.radius[i];
+                const Star& star = stars[snap.order[i]];
+                inst.r = star.r;
+                inst.g = star.g;
+                inst.b = star.b;
+                inst.a = 1;
+            }
+        }
+        if (chunk == chunks - 1) {
+            out.visible_count = 0;
+            for (int l = 0; l < circle_lod_count; l++) {
+                out.circle_offset[l] = level_start[l];
+                out.circle_count[l] = circles[l] - level_start[l];
+                out.visible_count += out.circle_count[l];
+            }
+            out.point_count = points;
+            out.impostor_count = impostors - total_points;
+        }
+    }
+
+    void rotate_around_x(float deg) {
+        PerfScope scope(REGION_ROTATE, groups.size() + 1);
+        for (UpdateGroup& group : groups)
+            group.motion.rotate_x(deg);
+        far_motion.rotate_x(deg);
+        closed.turn.rotate_x(deg);
+    }
+
+    void rotate_around_y(float deg) {
+        PerfScope scope(REGION_ROTATE, groups.size() + 1);
+        for (UpdateGroup& group : groups)
+            group.motion.rotate_y(deg);
+        far_motion.rotate_y(deg);
+        closed.turn.rotate_y(deg);
+    }
+
+    void rotate_around_z(float deg) {
+        PerfScope scope(REGION_ROTATE, groups.size() + 1);
+        for (UpdateGroup& group : groups)
+            group.motion.rotate_z(deg);
+        far_motion.rotate_z(deg);
+        closed.turn.rotate_z(deg);
+    }
+
+    void resize_all(float dr) {
+        for (Star& s : stars) {
+            if (s.radius + dr > 0)
+                s.radius += dr;
+        }
+    }
+
+    void set_velocity(Position vel) {
+        field_velocity = vel;
+    }
+
+    Position get_velocity() {
+        return field_velocity;
+    }
+
+    Position& get_velocity_ref() {
+        return field_velocity;
+    }
+
+    float get_speed() {
+        return sqrt(field_velocity.x * field_velocity.x + field_velocity.y * field_velocity.y + field_velocity.z * field_velocity.z);
+    }
+
+    void set_slowing_down(bool b) {
+        slowing_down = b;
+    }
+
+    bool get_slowing_down() {
+        return slowing_down;
+    }
+
+    size_t get_star_count() {
+        return stars.size();
+    }
+
+    // Stops moving the stars, from here on they're drawn from where they are now in closed form
+    void set_closed_form() {
+        closed_form = true;
+        closed = ClosedFormState{};
+    }
+
+    bool is_closed_form() {
+        return closed_form;
+    }
+
+    // Every star where it is now, for the closed form renderer's static buffer
+    void write_all_instances(std::vector<StarInstance>& out) {
+        out.clear();
+        gather_near_positions();
+        for (size_t k = 0; k < near_stars.size(); k++)
+            out.push_back(instance_of(near_stars[k], now_scratch[k]));
+        for (uint32_t i : far_stars)
+            out.push_back(instance_of(i, far_motion.carry(stars[i].center, drift_of(i))));
+    }
+
+    StarInstance instance_of(uint32_t i, Position p) {
+        StarInstance inst;
+        inst.x = p.x;
+        inst.y = p.y;
+        inst.z = p.z;
+        inst.radius = stars[i].radius;
+        inst.r = stars[i].r;
+        inst.g = stars[i].g;
+        inst.b = stars[i].b;
+        inst.a = 1;
+        return inst;
+    }
+
+    size_t get_far_count() {
+        return far_stars.size();
+    }
+
+    size_t get_cluster_count() {
+        return size_t(grid_x) * grid_y * grid_z;
+    }
+
+    // FNV-1a over every star center and the velocity, equal checksums mean bit identical state
+    uint64_t checksum() {
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&h](const void* data, size_t len) {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < len; i++) {
+                h ^= bytes[i];
+                h *= 1099511628211ull;
+            }
+        };
+        if (closed_form) {
+            mix(closed.turn.axes, sizeof(closed.turn.axes));
+            mix(closed.cells, sizeof(closed.cells));
+            mix(closed.displacement, sizeof(closed.displacement));
+        }
+        gather_near_positions();
+        for (Position p : now_scratch)
+            mix(&p.x, sizeof(float) * 3);
+        for (uint32_t i : far_stars) {
+            Position p = far_motion.carry(stars[i].center, drift_of(i));
+            mix(&p.x, sizeof(float) * 3);
+        }
+        mix(&field_velocity.x, sizeof(float) * 3);
+        return h;
+    }
+
+};
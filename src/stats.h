@@ -0,0 +1,313 @@
+#pragma once
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Renderer counters for a single frame
+struct FrameCounters {
+    uint64_t draw_calls = 0;
+    uint64_t triangles = 0;
+    uint64_t upload_bytes = 0;
+    uint64_t buffer_binds = 0;
+    uint64_t vao_binds = 0;
+    uint64_t program_switches = 0;
+    uint64_t visible_stars = 0;
+    // Drawn coarser than a circle, see the cluster levels of detail in starfield.h
+    uint64_t point_stars = 0;
+    uint64_t impostors = 0;
+    // Stars drawn from the baked far layer and how often it was baked
+    uint64_t far_stars = 0;
+    uint64_t far_bakes = 0;
+    // Near stars the simulation step behind the frame updated, see the update bands in starfield.h
+    uint64_t updated_stars = 0;
+};
+
+// Parts of a frame we time separately
+enum FramePhase {
+    PHASE_TICK,
+    PHASE_FINISH,
+    PHASE_INPUT,
+    PHASE_HUD,
+    PHASE_PRESENT,
+    PHASE_COUNT
+};
+
+const char* phase_names[PHASE_COUNT] = { "TICK", "FINISH", "INPUT", "HUD", "PRESENT" };
+
+// Time spent in each phase of a frame in seconds
+struct FramePhases {
+    double seconds[PHASE_COUNT] = {};
+};
+
+// Marks phase boundaries, each mark charges the time since the previous one to a phase
+class PhaseTimer {
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point last;
+    FramePhases phases;
+
+public:
+    void begin() {
+        phases = FramePhases{};
+        last = clock::now();
+    }
+
+    void mark(FramePhase phase) {
+        clock::time_point now = clock::now();
+        phases.seconds[phase] += std::chrono::duration<double>(now - last).count();
+        last = now;
+    }
+
+    const FramePhases& get() const {
+        return phases;
+    }
+};
+
+// Upper limits for the counters, 0 means unlimited
+struct CounterBudget {
+    uint64_t draw_calls = 0;
+    uint64_t upload_bytes = 0;
+};
+
+// Counters of the frame currently being rendered
+FrameCounters frame_counters;
+
+// False when running headless without a GL context, the wrappers below then only count
+bool gl_enabled = true;
+
+// Wrappers around the GL calls we want to count
+void counted_draw_elements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+    if (gl_enabled)
+        glDrawElements(mode, count, type, indices);
+    frame_counters.draw_calls++;
+    if (mode == GL_TRIANGLES)
+        frame_counters.triangles += count / 3;
+}
+
+void counted_draw_elements_instanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances) {
+    if (gl_enabled)
+        glDrawElementsInstanced(mode, count, type, indices, instances);
+    frame_counters.draw_calls++;
+    if (mode == GL_TRIANGLES)
+        frame_counters.triangles += uint64_t(count / 3) * instances;
+}
+
+void counted_draw_arrays(GLenum mode, GLint first, GLsizei count) {
+    if (gl_enabled)
+        glDrawArrays(mode, first, count);
+    frame_counters.draw_calls++;
+    if (mode == GL_TRIANGLES)
+        frame_counters.triangles += count / 3;
+}
+
+void counted_buffer_data(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+    if (gl_enabled)
+        glBufferData(target, size, data, usage);
+    frame_counters.upload_bytes += size;
+}
+
+void counted_buffer_sub_data(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+    if (gl_enabled)
+        glBufferSubData(target, offset, size, data);
+    frame_counters.upload_bytes += size;
+}
+
+void counted_bind_buffer(GLenum target, GLuint buffer) {
+    if (gl_enabled)
+        glBindBuffer(target, buffer);
+    frame_counters.buffer_binds++;
+}
+
+void counted_bind_vertex_array(GLuint array) {
+    if (gl_enabled)
+        glBindVertexArray(array);
+    frame_counters.vao_binds++;
+}
+
+void counted_use_program(GLuint program) {
+    if (gl_enabled)
+        glUseProgram(program);
+    frame_counters.program_switches++;
+}
+
+// Frames FrameStats keeps whole, for the overlay. Older frames only live on in the running sums
+const size_t frame_stats_window = 300;
+// Frame time histogram for the percentiles: buckets this wide, the last one takes everything slower
+const double frame_time_bucket = 0.00001;
+const size_t frame_time_buckets = 10000;
+
+// Sums the counters and frame times of every frame, keeps the last few whole and streams them to a CSV
+class FrameStats {
+
+    struct Record {
+        double frame_time;
+        FrameCounters counters;
+        FramePhases phases;
+        // From sampling the camera orientation to the present returning, 0 when not measured
+        double latency;
+    };
+
+    // Ring of the last frame_stats_window frames, next is where the next one goes
+    std::vector<Record> window;
+    size_t next = 0;
+    uint64_t frames = 0;
+    // Running totals for the summary
+    FrameCounters sum;
+    FramePhases phase_sum;
+    double time_sum = 0, latency_sum = 0, max_latency = 0;
+    uint64_t latency_frames = 0;
+    std::vector<uint64_t> time_histogram = std::vector<uint64_t>(frame_time_buckets);
+    CounterBudget budget;
+    uint64_t over_budget_frames = 0;
+    std::ofstream csv;
+
+    const Record& back(size_t i) const {
+        return window[(next + frame_stats_window - 1 - i) % frame_stats_window];
+    }
+
+    // Frame time below which a fraction q of the frames are, to a bucket
+    double frame_time_percentile(double q) const {
+        uint64_t target = uint64_t(q * (frames - 1)), seen = 0;
+        for (size_t b = 0; b < frame_time_buckets; b++) {
+            seen += time_histogram[b];
+            if (seen > target)
+                return (b + 1) * frame_time_bucket;
+        }
+        return frame_time_buckets * frame_time_bucket;
+    }
+
+public:
+    FrameStats() {
+        window.reserve(frame_stats_window);
+    }
+
+    void set_budget(CounterBudget b) {
+        budget = b;
+    }
+
+    // Every frame from now on is written to path as it ends
+    bool open_csv(const std::string& path) {
+        csv.open(path);
+        if (!csv)
+            return false;
+        csv << "frame,frame_time_ms,draw_calls,triangles,upload_bytes,buffer_binds,vao_binds,program_switches,visible_stars,point_stars,impostors,far_stars,far_bakes,updated_stars";
+        for (const char* name : phase_names)
+            csv << ',' << name << "_ms";
+        csv << ",latency_ms\n";
+        return true;
+    }
+
+    // Adds the counters of the frame that just ended and resets them
+    void end_frame(double frame_time, const FramePhases& phases = FramePhases{}, double latency = 0) {
+        const FrameCounters& c = frame_counters;
+        if ((budget.draw_calls && c.draw_calls > budget.draw_calls) ||
+            (budget.upload_bytes && c.upload_bytes > budget.upload_bytes)) {
+            over_budget_frames++;
+        }
+        Record r{ frame_time, c, phases, latency };
+        if (window.size() < frame_stats_window)
+            window.push_back(r);
+        else
+            window[next] = r;
+        next = (next + 1) % frame_stats_window;
+
+        time_sum += frame_time;
+        time_histogram[std::min(size_t(frame_time / frame_time_bucket), frame_time_buckets - 1)]++;
+        if (latency > 0) {
+            latency_sum += latency;
+            max_latency = std::max(max_latency, latency);
+            latency_frames++;
+        }
+        for (int p = 0; p < PHASE_COUNT; p++)
+            phase_sum.seconds[p] += phases.seconds[p];
+        sum.draw_calls += c.draw_calls;
+        sum.triangles += c.triangles;
+        sum.upload_bytes += c.upload_bytes;
+        sum.buffer_binds += c.buffer_binds;
+        sum.vao_binds += c.vao_binds;
+        sum.program_switches += c.program_switches;
+        sum.visible_stars += c.visible_stars;
+        sum.point_stars += c.point_stars;
+        sum.impostors += c.impostors;
+        sum.far_stars += c.far_stars;
+        sum.far_bakes += c.far_bakes;
+        sum.updated_stars += c.updated_stars;
+
+        if (csv.is_open()) {
+            csv << frames << ',' << frame_time * 1000 << ','
+                << c.draw_calls << ',' << c.triangles << ','
+                << c.upload_bytes << ',' << c.buffer_binds << ','
+                << c.vao_binds << ',' << c.program_switches << ','
+                << c.visible_stars << ',' << c.point_stars << ',' << c.impostors
+                << ',' << c.far_stars << ',' << c.far_bakes << ',' << c.updated_stars;
+            for (double t : phases.seconds)
+                csv << ',' << t * 1000;
+            csv << ',' << latency * 1000 << '\n';
+        }
+        frames++;
+        frame_counters = FrameCounters{};
+    }
+
+    size_t frame_count() const {
+        return size_t(frames);
+    }
+
+    const FrameCounters& last() const {
+        static const FrameCounters empty;
+        return window.empty() ? empty : back(0).counters;
+    }
+
+    const FramePhases& last_phases() const {
+        static const FramePhases empty;
+        return window.empty() ? empty : back(0).phases;
+    }
+
+    double last_latency() const {
+        return window.empty() ? 0 : back(0).latency;
+    }
+
+    // Frame time of the i-th frame counting back from the last one, 0 past the kept window
+    double frame_time_back(size_t i) const {
+        return i < window.size() ? back(i).frame_time : 0;
+    }
+
+    uint64_t get_over_budget_frames() const {
+        return over_budget_frames;
+    }
+
+    // Averages over the whole run
+    void print_summary(std::ostream& os) const {
+        if (frames == 0)
+            return;
+
+        double n = double(frames);
+        os << "frames: " << frames << "\n"
+            << "avg frame time (ms): " << time_sum / n * 1000 << "\n"
+            << "p50 frame time (ms): " << frame_time_percentile(0.5) * 1000 << "\n"
+            << "p99 frame time (ms): " << frame_time_percentile(0.99) * 1000 << "\n"
+            << "avg draw calls: " << sum.draw_calls / n << "\n"
+            << "avg triangles: " << sum.triangles / n << "\n"
+            << "avg upload bytes: " << sum.upload_bytes / n << "\n"
+            << "avg buffer binds: " << sum.buffer_binds / n << "\n"
+            << "avg vao binds: " << sum.vao_binds / n << "\n"
+            << "avg program switches: " << sum.program_switches / n << "\n"
+            << "avg visible stars: " << sum.visible_stars / n << "\n"
+            << "avg point stars: " << sum.point_stars / n << "\n"
+            << "avg impostors: " << sum.impostors / n << "\n"
+            << "avg far layer stars: " << sum.far_stars / n << "\n"
+            << "far layer bakes: " << sum.far_bakes << "\n"
+            << "avg stars updated per step: " << sum.updated_stars / n << "\n";
+        for (int p = 0; p < PHASE_COUNT; p++)
+            os << "avg " << phase_names[p] << " (ms): " << phase_sum.seconds[p] / n * 1000 << "\n";
+        if (latency_frames)
+            os << "avg input latency (ms): " << latency_sum / latency_frames * 1000 << "\n"
+                << "max input latency (ms): " << max_latency * 1000 << "\n";
+        if (over_budget_frames)
+            os << "frames over budget: " << over_budget_frames << "\n";
+    }
+};
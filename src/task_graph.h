@@ -0,0 +1,290 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "profiler.h"
+
+// 0 on threads the pool doesn't own, 1 and up on its workers
+thread_local int job_thread_index = 0;
+
+// Fixed set of worker threads taking jobs from one queue
+class JobSystem {
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool quit = false;
+    // Time the workers spent running jobs, for the utilization
+    std::atomic<uint64_t> busy_ns{ 0 };
+
+    void work(int index) {
+        job_thread_index = index;
+        profiler.register_thread("job " + std::to_string(index));
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return quit || !queue.empty(); });
+                if (queue.empty())
+                    break;
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            job();
+            busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+        profiler.unregister_thread();
+    }
+
+public:
+    explicit JobSystem(int threads) {
+        for (int i = 0; i < std::max(threads, 1); i++)
+            workers.emplace_back(&JobSystem::work, this, i + 1);
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers)
+            t.join();
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    int size() const {
+        return int(workers.size());
+    }
+
+    // Seconds of work done since the last call, summed over the workers
+    double take_busy_seconds() {
+        return busy_ns.exchange(0) / 1e9;
+    }
+};
+
+// Chrome trace events of the last few runs of a graph, open the file in chrome://tracing or Perfetto
+class TraceLog {
+
+    struct Event {
+        std::string name;
+        uint64_t frame;
+        int thread;
+        double start, duration;
+        bool critical;
+    };
+
+    std::deque<Event> events;
+    size_t max_events;
+
+public:
+    explicit TraceLog(size_t max_events = 20000) : max_events{ max_events } {
+    }
+
+    // start in seconds on any clock, as long as it's the same one for every event
+    void add(const std::string& name, uint64_t frame, int thread, double start, double duration, bool critical) {
+        events.push_back({ name, frame, thread, start, duration, critical });
+        if (events.size() > max_events)
+            events.pop_front();
+    }
+
+    bool write(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        double origin = events.empty() ? 0 : events.front().start;
+        out << "{\"traceEvents\":[\n";
+        for (size_t i = 0; i < events.size(); i++) {
+            const Event& e = events[i];
+            out << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+                << ",\"ts\":" << (e.start - origin) * 1e6 << ",\"dur\":" << e.duration * 1e6
+                << ",\"args\":{\"frame\":" << e.frame << ",\"critical\":" << (e.critical ? "true" : "false") << "}";
+            // Critical path in red
+            if (e.critical)
+                out << ",\"cname\":\"terrible\"";
+            out << "}" << (i + 1 < events.size() ? ",\n" : "\n");
+        }
+        out << "],\"displayTimeUnit\":\"ms\"}\n";
+        return true;
+    }
+};
+
+// Tasks and the tasks they wait for, run once per frame.
+// A task is split in parts that run in parallel on the pool, or runs on the thread calling run
+// when it has to, like everything touching GL. Tasks can only depend on tasks added before them
+class TaskGraph {
+
+    using clock = std::chrono::steady_clock;
+
+    struct Part {
+        double start = 0, end = 0;
+        int thread = 0;
+    };
+
+    struct Task {
+        std::string name;
+        std::function<void(int)> fn;
+        std::vector<int> deps, dependents;
+        int parts;
+        bool main_thread;
+        // Per run
+        int pending = 0, parts_left = 0;
+        std::vector<Part> timing;
+    };
+
+    std::vector<Task> tasks;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<int> main_ready;
+    size_t tasks_done = 0;
+    clock::time_point origin = clock::now();
+
+    double now() const {
+        return std::chrono::duration<double>(clock::now() - origin).count();
+    }
+
+    // Called with the lock held
+    void dispatch(int t, JobSystem& jobs) {
+        Task& task = tasks[t];
+        if (task.main_thread) {
+            main_ready.push_back(t);
+            changed.notify_all();
+            return;
+        }
+        for (int p = 0; p < task.parts; p++)
+            jobs.submit([this, t, p, &jobs] { run_part(t, p, jobs); });
+    }
+
+    void run_part(int t, int p, JobSystem& jobs) {
+        Task& task = tasks[t];
+        Part& part = task.timing[p];
+        part.thread = job_thread_index;
+        part.start = now();
+        task.fn(p);
+        part.end = now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--task.parts_left > 0)
+            return;
+        tasks_done++;
+        for (int d : task.dependents) {
+            if (--tasks[d].pending == 0)
+                dispatch(d, jobs);
+        }
+        changed.notify_all();
+    }
+
+public:
+    // fn gets the part index, main_thread tasks run on the thread calling run and aren't split
+    int add(const std::string& name, std::function<void(int)> fn, std::vector<int> deps, int parts = 1, bool main_thread = false) {
+        int id = int(tasks.size());
+        Task task;
+        task.name = name;
+        task.fn = std::move(fn);
+        task.deps = deps;
+        task.parts = main_thread ? 1 : std::max(parts, 1);
+        task.main_thread = main_thread;
+        tasks.push_back(std::move(task));
+        for (int d : deps)
+            tasks[d].dependents.push_back(id);
+        return id;
+    }
+
+    // Runs every task once and returns when they're all done
+    void run(JobSystem& jobs) {
+        std::unique_lock<std::mutex> lock(mutex);
+        tasks_done = 0;
+        for (Task& task : tasks) {
+            task.pending = int(task.deps.size());
+            task.parts_left = task.parts;
+            task.timing.assign(task.parts, Part{});
+        }
+        for (size_t t = 0; t < tasks.size(); t++) {
+            if (tasks[t].pending == 0)
+                dispatch(int(t), jobs);
+        }
+        while (tasks_done < tasks.size()) {
+            if (main_ready.empty()) {
+                changed.wait(lock);
+                continue;
+            }
+            int t = main_ready.front();
+            main_ready.pop_front();
+            lock.unlock();
+            run_part(t, 0, jobs);
+            lock.lock();
+        }
+    }
+
+    double task_start(int t) const {
+        double start = tasks[t].timing.front().start;
+        for (const Part& p : tasks[t].timing)
+            start = std::min(start, p.start);
+        return start;
+    }
+
+    double task_end(int t) const {
+        double end = 0;
+        for (const Part& p : tasks[t].timing)
+            end = std::max(end, p.end);
+        return end;
+    }
+
+    // Tasks of the last run that held up the end of the frame, first to last.
+    // Walks back from the task that finished last, each time to the dependency that finished last
+    std::vector<int> critical_path() const {
+        std::vector<int> path;
+        if (tasks.empty())
+            return path;
+        int t = 0;
+        for (size_t i = 1; i < tasks.size(); i++) {
+            if (task_end(int(i)) > task_end(t))
+                t = int(i);
+        }
+        while (true) {
+            path.push_back(t);
+            if (tasks[t].deps.empty())
+                break;
+            int last = tasks[t].deps.front();
+            for (int d : tasks[t].deps) {
+                if (task_end(d) > task_end(last))
+                    last = d;
+            }
+            t = last;
+        }
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
+
+    // One event per part of the last run
+    void append_trace(TraceLog& trace, uint64_t frame) const {
+        std::vector<int> path = critical_path();
+        for (size_t t = 0; t < tasks.size(); t++) {
+            bool critical = std::find(path.begin(), path.end(), int(t)) != path.end();
+            for (const Part& p : tasks[t].timing)
+                trace.add(tasks[t].name, frame, p.thread, p.start, p.end - p.start, critical);
+        }
+    }
+
+    const std::string& name(int t) const {
+        return tasks[t].name;
+    }
+};
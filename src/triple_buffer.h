@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest complete value from one producer thread to one consumer thread, neither side ever waits.
+// The producer fills the back slot and the consumer reads the front slot, publishing and picking up
+// swap them with the middle slot. The fresh bit marks a middle slot the consumer hasn't taken yet
+template <typename T>
+class TripleBuffer {
+
+    static const uint8_t fresh_bit = 4;
+
+    T slots[3];
+    std::atomic<uint8_t> middle{ 1 };
+    // Each owned by one side only
+    uint8_t back = 0, front = 2;
+
+public:
+    // Producer side, fill this then publish
+    T& write_slot() {
+        return slots[back];
+    }
+
+    void publish() {
+        uint8_t old = middle.exchange(uint8_t(back | fresh_bit), std::memory_order_acq_rel);
+        back = old & 3;
+    }
+
+    // Consumer side, returns whether a newer value was picked up
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & fresh_bit))
+            return false;
+        uint8_t old = middle.exchange(front, std::memory_order_acq_rel);
+        front = old & 3;
+        return true;
+    }
+
+    const T& read_slot() const {
+        return slots[front];
+    }
+};